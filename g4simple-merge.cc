@@ -0,0 +1,183 @@
+/*
+Combines the "map" ntuples of several shard outputs (/generator/shard i n) into one file.
+Rows are sorted by (sweepIndex, voxelIndex), so the result has the same rows in the same order as a
+single job with the same macro & seed.
+
+Usage: g4simple-merge output.root shard0.root shard1.root ...
+*/
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "globals.hh"
+#include "g4root.hh"
+
+using namespace std;
+
+struct MapRow{
+  G4double xPos, yPos, zPos;
+  G4int counts, initialNr, voxelIndex, sweepIndex;
+  G4double xWid, yWid, zWid;
+  G4double larFraction, qmcError;
+  G4double sumW, sumW2, nee;
+};
+
+struct SweepRow{
+  G4int sweepIndex, rayleigh;
+  G4double lArAbsLength, visAbsLength, fiberDetProb;
+  G4double reflectivity[6];	//Cu, Tetratex, Ge @ vuv & vis
+};
+
+const char* reflectivityColumns[6] = {"reflCuVUV", "reflCuVis", "reflTetraVUV", "reflTetraVis", "reflGeVUV", "reflGeVis"};
+
+bool bySweepAndVoxel(const MapRow& a, const MapRow& b){
+  if(a.sweepIndex != b.sweepIndex) return a.sweepIndex < b.sweepIndex;
+  return a.voxelIndex < b.voxelIndex;
+}
+
+
+int main(int argc, char** argv)
+{
+  if(argc < 3) {
+    cout << "Usage: " << argv[0] << " output.root input.root [input.root ...]" << endl;
+    return 1;
+  }
+
+  vector<MapRow> rows;
+  G4Root::G4AnalysisReader* reader = G4Root::G4AnalysisReader::Instance();
+  for(int i = 2; i < argc; i++) {
+    G4int id = reader->GetNtuple("map", argv[i]);
+    if(id < 0) {
+      cout << "No map ntuple in " << argv[i] << endl;
+      return 1;
+    }
+    MapRow row;
+    reader->SetNtupleDColumn(id, "xPos", row.xPos);
+    reader->SetNtupleDColumn(id, "yPos", row.yPos);
+    reader->SetNtupleDColumn(id, "zPos", row.zPos);
+    reader->SetNtupleIColumn(id, "counts", row.counts);
+    reader->SetNtupleIColumn(id, "initialNr", row.initialNr);
+    reader->SetNtupleIColumn(id, "voxelIndex", row.voxelIndex);
+    reader->SetNtupleIColumn(id, "sweepIndex", row.sweepIndex);
+    reader->SetNtupleDColumn(id, "xWid", row.xWid);
+    reader->SetNtupleDColumn(id, "yWid", row.yWid);
+    reader->SetNtupleDColumn(id, "zWid", row.zWid);
+    reader->SetNtupleDColumn(id, "larFraction", row.larFraction);
+    reader->SetNtupleDColumn(id, "qmcError", row.qmcError);
+    reader->SetNtupleDColumn(id, "sumW", row.sumW);
+    reader->SetNtupleDColumn(id, "sumW2", row.sumW2);
+    reader->SetNtupleDColumn(id, "nee", row.nee);
+    size_t before = rows.size();
+    while(reader->GetNtupleRow(id)) rows.push_back(row);
+    cout << argv[i] << ": " << rows.size()-before << " voxels" << endl;
+  }
+
+  //sweep parameters are the same in all shards (same macro): take them from the 1st one
+  vector<SweepRow> sweeps;
+  G4int sweepId = reader->GetNtuple("sweep", argv[2]);
+  if(sweepId >= 0) {
+    SweepRow sweep;
+    reader->SetNtupleIColumn(sweepId, "sweepIndex", sweep.sweepIndex);
+    reader->SetNtupleDColumn(sweepId, "lArAbsLength", sweep.lArAbsLength);
+    reader->SetNtupleDColumn(sweepId, "visAbsLength", sweep.visAbsLength);
+    reader->SetNtupleDColumn(sweepId, "fiberDetProb", sweep.fiberDetProb);
+    reader->SetNtupleIColumn(sweepId, "rayleigh", sweep.rayleigh);
+    for(int i = 0; i < 6; i++) {
+      sweep.reflectivity[i] = -1;	//older files: not there
+      reader->SetNtupleDColumn(sweepId, reflectivityColumns[i], sweep.reflectivity[i]);
+    }
+    while(reader->GetNtupleRow(sweepId)) sweeps.push_back(sweep);
+  }
+
+  //scan layout: same for all shards as well
+  G4double symmetryAngle = -1;
+  G4int polarGrid = 0;
+  G4bool hasMeta = false;
+  G4int metaId = reader->GetNtuple("meta", argv[2]);
+  if(metaId >= 0) {
+    reader->SetNtupleDColumn(metaId, "symmetryAngle", symmetryAngle);
+    reader->SetNtupleIColumn(metaId, "polarGrid", polarGrid);
+    hasMeta = reader->GetNtupleRow(metaId);
+  }
+
+  stable_sort(rows.begin(), rows.end(), bySweepAndVoxel);
+  for(size_t i = 1; i < rows.size(); i++) {
+    if(rows[i].voxelIndex == rows[i-1].voxelIndex && rows[i].sweepIndex == rows[i-1].sweepIndex) {
+      cout << "Voxel " << rows[i].voxelIndex << " (sweep point " << rows[i].sweepIndex << ") found twice: overlapping shards?" << endl;
+      return 1;
+    }
+  }
+
+  //same layout as RunList::openFile
+  G4Root::G4AnalysisManager* analysis = G4Root::G4AnalysisManager::Instance();
+  analysis->CreateNtuple("map","geant4 map data");
+  analysis->CreateNtupleDColumn("xPos");
+  analysis->CreateNtupleDColumn("yPos");
+  analysis->CreateNtupleDColumn("zPos");
+  analysis->CreateNtupleIColumn("counts");
+  analysis->CreateNtupleIColumn("initialNr");
+  analysis->CreateNtupleIColumn("voxelIndex");
+  analysis->CreateNtupleIColumn("sweepIndex");
+  analysis->CreateNtupleDColumn("xWid");
+  analysis->CreateNtupleDColumn("yWid");
+  analysis->CreateNtupleDColumn("zWid");
+  analysis->CreateNtupleDColumn("larFraction");
+  analysis->CreateNtupleDColumn("qmcError");
+  analysis->CreateNtupleDColumn("sumW");
+  analysis->CreateNtupleDColumn("sumW2");
+  analysis->CreateNtupleDColumn("nee");
+  analysis->FinishNtuple();
+  analysis->CreateNtuple("sweep","optical parameters per sweepIndex");
+  analysis->CreateNtupleIColumn("sweepIndex");
+  analysis->CreateNtupleDColumn("lArAbsLength");
+  analysis->CreateNtupleDColumn("visAbsLength");
+  analysis->CreateNtupleDColumn("fiberDetProb");
+  analysis->CreateNtupleIColumn("rayleigh");
+  for(int i = 0; i < 6; i++) analysis->CreateNtupleDColumn(reflectivityColumns[i]);
+  analysis->FinishNtuple();
+  analysis->CreateNtuple("meta","scan layout");
+  analysis->CreateNtupleDColumn("symmetryAngle");
+  analysis->CreateNtupleIColumn("polarGrid");
+  analysis->FinishNtuple();
+  analysis->OpenFile(argv[1]);
+  for(size_t i = 0; i < rows.size(); i++) {
+    analysis->FillNtupleDColumn(0, rows[i].xPos);
+    analysis->FillNtupleDColumn(1, rows[i].yPos);
+    analysis->FillNtupleDColumn(2, rows[i].zPos);
+    analysis->FillNtupleIColumn(3, rows[i].counts);
+    analysis->FillNtupleIColumn(4, rows[i].initialNr);
+    analysis->FillNtupleIColumn(5, rows[i].voxelIndex);
+    analysis->FillNtupleIColumn(6, rows[i].sweepIndex);
+    analysis->FillNtupleDColumn(7, rows[i].xWid);
+    analysis->FillNtupleDColumn(8, rows[i].yWid);
+    analysis->FillNtupleDColumn(9, rows[i].zWid);
+    analysis->FillNtupleDColumn(10, rows[i].larFraction);
+    analysis->FillNtupleDColumn(11, rows[i].qmcError);
+    analysis->FillNtupleDColumn(12, rows[i].sumW);
+    analysis->FillNtupleDColumn(13, rows[i].sumW2);
+    analysis->FillNtupleDColumn(14, rows[i].nee);
+    analysis->AddNtupleRow();
+  }
+  for(size_t i = 0; i < sweeps.size(); i++) {
+    analysis->FillNtupleIColumn(1, 0, sweeps[i].sweepIndex);
+    analysis->FillNtupleDColumn(1, 1, sweeps[i].lArAbsLength);
+    analysis->FillNtupleDColumn(1, 2, sweeps[i].visAbsLength);
+    analysis->FillNtupleDColumn(1, 3, sweeps[i].fiberDetProb);
+    analysis->FillNtupleIColumn(1, 4, sweeps[i].rayleigh);
+    for(int r = 0; r < 6; r++) analysis->FillNtupleDColumn(1, 5 + r, sweeps[i].reflectivity[r]);
+    analysis->AddNtupleRow(1);
+  }
+  if(hasMeta) {
+    analysis->FillNtupleDColumn(2, 0, symmetryAngle);
+    analysis->FillNtupleIColumn(2, 1, polarGrid);
+    analysis->AddNtupleRow(2);
+  }
+  analysis->Write();
+  analysis->CloseFile();
+  cout << "Wrote " << rows.size() << " voxels to " << argv[1] << endl;
+
+  delete analysis;
+  delete reader;
+  return 0;
+}
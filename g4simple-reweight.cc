@@ -0,0 +1,372 @@
+/*
+Maps for other LAr absorption lengths & surface reflectivities from one run w/ /write/detections: every detected
+photon gets the likelihood ratio
+  exp(-lVUV*(1/lArAbsLength' - 1/lArAbsLength) - lVis*(1/visAbsLength' - 1/visAbsLength)) * prod (R'/R)^nBounces
+over the reflectivities R of Cu, Tetratex & Ge @ 128 & 450 nm; values of the run from its sweep ntuple (per sweepIndex).
+Output: map, sweep & meta ntuples as written by g4simple (sumW, sumW2 & counts from the detections; nee -1), one sweep
+point per (input sweep point, combination of the new values), plus the ess ntuple: effective sample size
+(sum w)^2/sum w^2 of the reweighted detections per voxel & its fraction of the unweighted one. Small fractions: the
+run is too far from these values, simulate closer to them.
+
+Usage: g4simple-reweight output.root input.root [input.root ...] [--<parameter> values ...]
+parameters: lArAbsLength, visAbsLength (unit mm, cm or m as last entry, default mm),
+            reflCuVUV, reflCuVis, reflTetraVUV, reflTetraVis, reflGeVUV, reflGeVis
+(shards of one job can be given together)
+*/
+#include <iostream>
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "globals.hh"
+#include "G4SystemOfUnits.hh"
+#include "g4root.hh"
+
+using namespace std;
+
+struct MapRow{
+  G4double xPos, yPos, zPos;
+  G4int counts, initialNr, voxelIndex, sweepIndex;
+  G4double xWid, yWid, zWid;
+  G4double larFraction, qmcError;
+  G4double sumW, sumW2, nee;
+};
+
+//what a run can be reweighted in: columns of the sweep ntuple, --<name> on the command line
+const int nrParameters = 8;
+const char* parameterNames[nrParameters] = {"lArAbsLength", "visAbsLength",
+  "reflCuVUV", "reflCuVis", "reflTetraVUV", "reflTetraVis", "reflGeVUV", "reflGeVis"};
+//reflections per detected photon, same order as the reflectivities above
+const int nrBounces = 6;
+const char* bounceNames[nrBounces] = {"nCuVUV", "nCuVis", "nTetraVUV", "nTetraVis", "nGeVUV", "nGeVis"};
+
+struct SweepRow{
+  G4int sweepIndex, rayleigh;
+  G4double fiberDetProb;
+  G4double value[nrParameters];
+};
+
+//reweighted sums of one voxel, one entry per new sweep point
+struct VoxelSums{
+  G4int detections;
+  G4double sumW0, sumW0Sq;		//unweighted (reference)
+  vector<G4double> sumW, sumWSq, sumW2;	//sumWSq: per detection (ess), sumW2: per primary (as in the map)
+};
+
+G4double newValue(const vector<vector<G4double> >& newValues, const vector<size_t>& stride, int a, size_t k, const SweepRow& reference){
+  if(newValues[a].empty()) return reference.value[a];
+  return newValues[a][(k/stride[a]) % newValues[a].size()];
+}
+
+G4double inverse(G4double length){
+  return (length > 0) ? 1./length : 0.;	//<= 0: no absorption
+}
+
+//numbers, lengths w/ optional unit (mm, cm, m) as last entry
+bool parseValues(const vector<string>& tokens, bool lengths, vector<G4double>& values){
+  G4double unit = lengths ? mm : 1.;
+  size_t n = tokens.size();
+  if(lengths && n > 0 && (tokens[n-1] == "mm" || tokens[n-1] == "cm" || tokens[n-1] == "m")) {
+    unit = (tokens[n-1] == "mm") ? mm : (tokens[n-1] == "cm") ? cm : m;
+    n--;
+  }
+  for(size_t i = 0; i < n; i++) {
+    char* end;
+    G4double value = strtod(tokens[i].c_str(), &end);
+    if(*end != '\0') return false;
+    values.push_back(value*unit);
+  }
+  return !values.empty();
+}
+
+
+int main(int argc, char** argv)
+{
+  vector<string> inputs;
+  vector<vector<string> > tokens(nrParameters);
+  int list = -1;
+  bool valid = (argc >= 3);
+  for(int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if(arg.compare(0, 2, "--") == 0) {
+      list = -1;
+      for(int a = 0; a < nrParameters; a++) if(arg == string("--") + parameterNames[a]) list = a;
+      if(list < 0) valid = false;
+    }
+    else if(list >= 0) tokens[list].push_back(arg);
+    else inputs.push_back(arg);
+  }
+  //new values per parameter; empty: value of the run. Combinations: mixed radix, last parameter fastest
+  vector<vector<G4double> > newValues(nrParameters);
+  bool any = false;
+  for(int a = 0; a < nrParameters; a++) {
+    if(tokens[a].empty()) continue;
+    any = true;
+    if(!parseValues(tokens[a], a < 2, newValues[a])) valid = false;
+  }
+  if(!valid || !any || inputs.empty()) {
+    cout << "Usage: " << argv[0] << " output.root input.root [input.root ...] [--lArAbsLength 200 300 mm] [--visAbsLength 1 10 m]"
+         << " [--reflTetraVis 0.9 0.95 0.98] ..." << endl;
+    cout << "Parameters: lArAbsLength visAbsLength reflCuVUV reflCuVis reflTetraVUV reflTetraVis reflGeVUV reflGeVis" << endl;
+    return 1;
+  }
+  size_t nNew = 1;
+  vector<size_t> stride(nrParameters);
+  for(int a = nrParameters-1; a >= 0; a--) {
+    stride[a] = nNew;
+    nNew *= max<size_t>(newValues[a].size(), 1);
+  }
+
+  G4Root::G4AnalysisReader* reader = G4Root::G4AnalysisReader::Instance();
+
+  //lengths of the run per sweep point: same in all inputs (same macro)
+  map<G4int, SweepRow> sweeps;
+  G4int sweepId = reader->GetNtuple("sweep", inputs[0]);
+  if(sweepId < 0) {
+    cout << "No sweep ntuple in " << inputs[0] << endl;
+    return 1;
+  }
+  SweepRow sweep;
+  reader->SetNtupleIColumn(sweepId, "sweepIndex", sweep.sweepIndex);
+  reader->SetNtupleDColumn(sweepId, "fiberDetProb", sweep.fiberDetProb);
+  reader->SetNtupleIColumn(sweepId, "rayleigh", sweep.rayleigh);
+  for(int a = 0; a < nrParameters; a++) {
+    sweep.value[a] = -1;	//reflectivities: not in older files
+    reader->SetNtupleDColumn(sweepId, parameterNames[a], sweep.value[a]);
+  }
+  while(reader->GetNtupleRow(sweepId)) {
+    for(int a = 2; a < nrParameters; a++) {
+      if(!newValues[a].empty() && sweep.value[a] <= 0) {
+        cout << parameterNames[a] << " of the run (sweep point " << sweep.sweepIndex << ") unknown or 0: cannot reweight it" << endl;
+        return 1;
+      }
+    }
+    sweeps[sweep.sweepIndex] = sweep;
+  }
+
+  vector<MapRow> rows;
+  map<pair<G4int, G4int>, VoxelSums> sums;	//(sweepIndex, voxelIndex)
+  for(size_t f = 0; f < inputs.size(); f++) {
+    const char* file = inputs[f].c_str();
+    G4int id = reader->GetNtuple("map", file);
+    G4int detId = reader->GetNtuple("detections", file);
+    if(id < 0 || detId < 0) {
+      cout << "No map or detections ntuple in " << file << " (run w/ /write/detections true)" << endl;
+      return 1;
+    }
+    MapRow row;
+    reader->SetNtupleDColumn(id, "xPos", row.xPos);
+    reader->SetNtupleDColumn(id, "yPos", row.yPos);
+    reader->SetNtupleDColumn(id, "zPos", row.zPos);
+    reader->SetNtupleIColumn(id, "counts", row.counts);
+    reader->SetNtupleIColumn(id, "initialNr", row.initialNr);
+    reader->SetNtupleIColumn(id, "voxelIndex", row.voxelIndex);
+    reader->SetNtupleIColumn(id, "sweepIndex", row.sweepIndex);
+    reader->SetNtupleDColumn(id, "xWid", row.xWid);
+    reader->SetNtupleDColumn(id, "yWid", row.yWid);
+    reader->SetNtupleDColumn(id, "zWid", row.zWid);
+    reader->SetNtupleDColumn(id, "larFraction", row.larFraction);
+    reader->SetNtupleDColumn(id, "qmcError", row.qmcError);
+    reader->SetNtupleDColumn(id, "sumW", row.sumW);
+    reader->SetNtupleDColumn(id, "sumW2", row.sumW2);
+    reader->SetNtupleDColumn(id, "nee", row.nee);
+    while(reader->GetNtupleRow(id)) {
+      if(sweeps.find(row.sweepIndex) == sweeps.end()) {
+        cout << "Sweep point " << row.sweepIndex << " missing in the sweep ntuple of " << inputs[0] << endl;
+        return 1;
+      }
+      rows.push_back(row);
+      VoxelSums& voxel = sums[make_pair(row.sweepIndex, row.voxelIndex)];
+      voxel.detections = 0;
+      voxel.sumW0 = voxel.sumW0Sq = 0;
+      voxel.sumW.assign(nNew, 0);
+      voxel.sumWSq.assign(nNew, 0);
+      voxel.sumW2.assign(nNew, 0);
+    }
+
+    //detections of an event are consecutive: per primary sums are squared when the event changes
+    G4int voxelIndex, sweepIndex, eventID, primary;
+    G4double weight, lVUV, lVis;
+    G4int bounces[nrBounces];
+    reader->SetNtupleIColumn(detId, "voxelIndex", voxelIndex);
+    reader->SetNtupleIColumn(detId, "sweepIndex", sweepIndex);
+    reader->SetNtupleIColumn(detId, "eventID", eventID);
+    reader->SetNtupleIColumn(detId, "primary", primary);
+    reader->SetNtupleDColumn(detId, "weight", weight);
+    reader->SetNtupleDColumn(detId, "lVUV", lVUV);
+    reader->SetNtupleDColumn(detId, "lVis", lVis);
+    for(int b = 0; b < nrBounces; b++) reader->SetNtupleIColumn(detId, bounceNames[b], bounces[b]);
+    VoxelSums* current = NULL;
+    G4int currentEvent = -1;
+    map<G4int, vector<G4double> > primaries;
+    size_t nrDetections = 0;
+    while(true) {
+      G4bool more = reader->GetNtupleRow(detId);
+      VoxelSums* next = NULL;
+      if(more) {
+        map<pair<G4int, G4int>, VoxelSums>::iterator it = sums.find(make_pair(sweepIndex, voxelIndex));
+        if(it == sums.end()) {
+          cout << "Detection in voxel " << voxelIndex << " (sweep point " << sweepIndex << ") w/o map row in " << file << endl;
+          return 1;
+        }
+        next = &it->second;
+      }
+      if(current != NULL && (next != current || eventID != currentEvent)) {
+        for(map<G4int, vector<G4double> >::const_iterator p = primaries.begin(); p != primaries.end(); ++p) {
+          for(size_t k = 0; k < nNew; k++) current->sumW2[k] += p->second[k]*p->second[k];
+        }
+        primaries.clear();
+      }
+      if(!more) break;
+      current = next;
+      currentEvent = eventID;
+      const SweepRow& reference = sweeps[sweepIndex];
+      vector<G4double>& perPrimary = primaries[primary];
+      perPrimary.resize(nNew, 0);
+      current->detections++;
+      current->sumW0 += weight;
+      current->sumW0Sq += weight*weight;
+      for(size_t k = 0; k < nNew; k++) {
+        G4double exponent = -lVUV*(inverse(newValue(newValues, stride, 0, k, reference)) - inverse(reference.value[0]))
+                            - lVis*(inverse(newValue(newValues, stride, 1, k, reference)) - inverse(reference.value[1]));
+        for(int b = 0; b < nrBounces; b++) {
+          if(!newValues[2+b].empty() && bounces[b] > 0) exponent += bounces[b]*log(newValue(newValues, stride, 2+b, k, reference)/reference.value[2+b]);
+        }
+        G4double w = weight*exp(exponent);
+        current->sumW[k] += w;
+        current->sumWSq[k] += w*w;
+        perPrimary[k] += w;
+      }
+      nrDetections++;
+    }
+    cout << file << ": " << nrDetections << " detections" << endl;
+  }
+
+  //scan layout: same for all inputs
+  G4double symmetryAngle = -1;
+  G4int polarGrid = 0;
+  G4bool hasMeta = false;
+  G4int metaId = reader->GetNtuple("meta", inputs[0]);
+  if(metaId >= 0) {
+    reader->SetNtupleDColumn(metaId, "symmetryAngle", symmetryAngle);
+    reader->SetNtupleIColumn(metaId, "polarGrid", polarGrid);
+    hasMeta = reader->GetNtupleRow(metaId);
+  }
+
+  //same layout as RunList::openFile
+  G4Root::G4AnalysisManager* analysis = G4Root::G4AnalysisManager::Instance();
+  analysis->CreateNtuple("map","geant4 map data");
+  analysis->CreateNtupleDColumn("xPos");
+  analysis->CreateNtupleDColumn("yPos");
+  analysis->CreateNtupleDColumn("zPos");
+  analysis->CreateNtupleIColumn("counts");
+  analysis->CreateNtupleIColumn("initialNr");
+  analysis->CreateNtupleIColumn("voxelIndex");
+  analysis->CreateNtupleIColumn("sweepIndex");
+  analysis->CreateNtupleDColumn("xWid");
+  analysis->CreateNtupleDColumn("yWid");
+  analysis->CreateNtupleDColumn("zWid");
+  analysis->CreateNtupleDColumn("larFraction");
+  analysis->CreateNtupleDColumn("qmcError");
+  analysis->CreateNtupleDColumn("sumW");
+  analysis->CreateNtupleDColumn("sumW2");
+  analysis->CreateNtupleDColumn("nee");
+  analysis->FinishNtuple();
+  analysis->CreateNtuple("sweep","optical parameters per sweepIndex");
+  analysis->CreateNtupleIColumn("sweepIndex");
+  analysis->CreateNtupleDColumn("lArAbsLength");
+  analysis->CreateNtupleDColumn("visAbsLength");
+  analysis->CreateNtupleDColumn("fiberDetProb");
+  analysis->CreateNtupleIColumn("rayleigh");
+  for(int a = 2; a < nrParameters; a++) analysis->CreateNtupleDColumn(parameterNames[a]);
+  analysis->FinishNtuple();
+  analysis->CreateNtuple("meta","scan layout");
+  analysis->CreateNtupleDColumn("symmetryAngle");
+  analysis->CreateNtupleIColumn("polarGrid");
+  analysis->FinishNtuple();
+  analysis->CreateNtuple("ess","effective sample size of the reweighted detections");
+  analysis->CreateNtupleIColumn("sweepIndex");
+  analysis->CreateNtupleIColumn("voxelIndex");
+  analysis->CreateNtupleDColumn("ess");
+  analysis->CreateNtupleDColumn("essFraction");	//ess / ess of the run itself
+  analysis->FinishNtuple();
+  analysis->OpenFile(argv[1]);
+
+  size_t mismatched = 0;
+  vector<G4double> worstFraction(sweeps.size()*nNew, 1.);
+  vector<size_t> lowEss(sweeps.size()*nNew, 0);
+  for(size_t i = 0; i < rows.size(); i++) {
+    const MapRow& row = rows[i];
+    const VoxelSums& voxel = sums[make_pair(row.sweepIndex, row.voxelIndex)];
+    if(fabs(voxel.sumW0 - row.sumW) > 1e-6*max(1., fabs(row.sumW))) mismatched++;
+    G4double ess0 = (voxel.sumW0Sq > 0) ? voxel.sumW0*voxel.sumW0/voxel.sumW0Sq : 0;
+    for(size_t k = 0; k < nNew; k++) {
+      G4int index = row.sweepIndex*nNew + k;
+      analysis->FillNtupleDColumn(0, row.xPos);
+      analysis->FillNtupleDColumn(1, row.yPos);
+      analysis->FillNtupleDColumn(2, row.zPos);
+      analysis->FillNtupleIColumn(3, voxel.detections);
+      analysis->FillNtupleIColumn(4, row.initialNr);
+      analysis->FillNtupleIColumn(5, row.voxelIndex);
+      analysis->FillNtupleIColumn(6, index);
+      analysis->FillNtupleDColumn(7, row.xWid);
+      analysis->FillNtupleDColumn(8, row.yWid);
+      analysis->FillNtupleDColumn(9, row.zWid);
+      analysis->FillNtupleDColumn(10, row.larFraction);
+      analysis->FillNtupleDColumn(11, -1);
+      analysis->FillNtupleDColumn(12, voxel.sumW[k]);
+      analysis->FillNtupleDColumn(13, voxel.sumW2[k]);
+      analysis->FillNtupleDColumn(14, -1);
+      analysis->AddNtupleRow();
+
+      G4double ess = (voxel.sumWSq[k] > 0) ? voxel.sumW[k]*voxel.sumW[k]/voxel.sumWSq[k] : 0;
+      G4double fraction = (ess0 > 0) ? ess/ess0 : 1.;
+      analysis->FillNtupleIColumn(3, 0, index);
+      analysis->FillNtupleIColumn(3, 1, row.voxelIndex);
+      analysis->FillNtupleDColumn(3, 2, ess);
+      analysis->FillNtupleDColumn(3, 3, fraction);
+      analysis->AddNtupleRow(3);
+      size_t slot = distance(sweeps.begin(), sweeps.find(row.sweepIndex))*nNew + k;
+      worstFraction[slot] = min(worstFraction[slot], fraction);
+      if(fraction < 0.1) lowEss[slot]++;
+    }
+  }
+  size_t slot = 0;
+  for(map<G4int, SweepRow>::const_iterator it = sweeps.begin(); it != sweeps.end(); ++it) {
+    for(size_t k = 0; k < nNew; k++, slot++) {
+      G4double value[nrParameters];
+      for(int a = 0; a < nrParameters; a++) value[a] = newValue(newValues, stride, a, k, it->second);
+      analysis->FillNtupleIColumn(1, 0, it->first*nNew + k);
+      analysis->FillNtupleDColumn(1, 1, value[0]);
+      analysis->FillNtupleDColumn(1, 2, value[1]);
+      analysis->FillNtupleDColumn(1, 3, it->second.fiberDetProb);
+      analysis->FillNtupleIColumn(1, 4, it->second.rayleigh);
+      for(int a = 2; a < nrParameters; a++) analysis->FillNtupleDColumn(1, 3 + a, value[a]);
+      analysis->AddNtupleRow(1);
+      cout << "Sweep point " << it->first*nNew + k << " (lArAbsLength " << value[0]/cm << " cm, visAbsLength " << value[1]/cm << " cm";
+      for(int a = 2; a < nrParameters; a++) {
+        if(!newValues[a].empty()) cout << ", " << parameterNames[a] << " " << value[a];
+      }
+      cout << "): smallest ess fraction " << worstFraction[slot] << ", " << lowEss[slot] << " voxels below 0.1" << endl;
+    }
+  }
+  if(hasMeta) {
+    analysis->FillNtupleDColumn(2, 0, symmetryAngle);
+    analysis->FillNtupleIColumn(2, 1, polarGrid);
+    analysis->AddNtupleRow(2);
+  }
+  analysis->Write();
+  analysis->CloseFile();
+  if(mismatched > 0) {
+    cout << "Warning: in " << mismatched << " voxels sumW of the run differs from its detections"
+         << " (WLSR table or missing detections): only the detections are reweighted" << endl;
+  }
+  cout << "Wrote " << rows.size()*nNew << " rows to " << argv[1] << endl;
+
+  delete analysis;
+  delete reader;
+  return 0;
+}
@@ -2,12 +2,18 @@
 #include <vector>
 #include <string>
 #include <regex>
+#include <cstdlib>
 #include <utility>
 
 #include "G4RunManager.hh"
+#ifdef G4SIMPLE_MT
+#include "G4MTRunManager.hh"
+#include "G4Threading.hh"
+#endif
 #include "G4Run.hh"
 #include "G4VUserDetectorConstruction.hh"
 #include "G4VUserPrimaryGeneratorAction.hh"
+#include "G4VUserActionInitialization.hh"
 #include "G4GeneralParticleSource.hh"
 #include "G4UIterminal.hh"
 #include "G4UItcsh.hh"
@@ -16,6 +22,7 @@
 #include "G4VisExecutive.hh"
 #include "G4UserSteppingAction.hh"
 #include "G4Track.hh"
+#include "G4SteppingManager.hh"
 #include "G4EventManager.hh"
 #include "G4UIdirectory.hh"
 #include "G4UIcmdWithAString.hh"
@@ -39,6 +46,7 @@
 #include "L200FiberPhysics.hh"
 #include "L200OpBoundaryProcess.hh"
 #include "RunList.hh"
+#include "WlsrResponseTable.hh"
 
 #include "g4root.hh"
 #include "g4xml.hh"
@@ -61,6 +69,10 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
     G4UIcmdWithAString* fOutputOptionCmd;
     G4UIcmdWithABool* fRecordAllStepsCmd;
     G4UIcmdWithADouble* fSetFiberAbsProbCmd;
+    G4UIcmdWithADouble* fImplicitCaptureCmd;
+    G4UIcmdWithAnInteger* fTpbSplittingCmd;
+    G4UIcmdWithAnInteger* fSplittingCapCmd;
+    G4UIcmdWithAnInteger* fNeeCmd;
 	  G4UIcmdWithAnInteger* fSetVerboseCmd;
 
     enum EFormat { kCsv, kXml, kRoot, kHdf5 };
@@ -97,10 +109,30 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
     G4double fiberAbsProb;		//fiber absorption
     map<G4VPhysicalVolume*, int> fVolIDMap;
 
+    //splitting @ TPB conversion: K fiber rolls (shroud) or K photons (WLSR), each w/ 1/K of the weight
+    G4int fSplitting;
+    G4int fSplittingCap;		//max nr of extra photons per primary photon (averaged over the event)
+    G4int fClonesInEvent;
+    G4int fRootEvent;
+    map<G4int, G4int> fRootOf;		//track ID -> track ID of its primary photon (current event)
+    struct PhotonHistory{		//of a track incl. its ancestors (/write/detections)
+	G4double lVUV;		//LAr path @ 128 nm
+	G4double lVis;		//@ 450 nm
+	G4int bounces[MapRunAction::nrBounceCounters];	//reflections on Cu, Tetratex & Ge (see MapRunAction::Detection)
+    };
+    map<G4int, PhotonHistory> fHistoryOf;	//track ID -> history (current event)
+
+    G4int fNeeSteps;		//next-event estimator: quadrature cells per axis; 0: off
+    L200DetectorConstruction* fDetector;	//NULL: not the L200 geometry (no estimator)
+    G4bool fDetectorLookedUp;
+
 	MapRunAction* mra;
+	L200ParticleGenerator* fGenerator;	//generator of this thread: adjoint mode & grid lookup (may be NULL)
 
   public:
-    G4SimpleSteppingAction(MapRunAction* mra) : fNEvents(0), fEventNumber(0), mra(mra), verbosity(4) {
+    G4SimpleSteppingAction(MapRunAction* mra, L200ParticleGenerator* generator = NULL) : fNEvents(0), fEventNumber(0), mra(mra), verbosity(4),
+      fSplitting(1), fSplittingCap(100), fClonesInEvent(0), fRootEvent(-1), fNeeSteps(0), fDetector(NULL), fDetectorLookedUp(false),
+      fGenerator(generator) {
       ResetVars();
 
       fVolIDCmd = new G4UIcommand("/g4simple/setVolID", this);
@@ -132,6 +164,32 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       fSetFiberAbsProbCmd->SetGuidance("Set the detection probability of the fiber shrouds (absorption)!");
       fiberAbsProb = 0.;
 
+      fImplicitCaptureCmd = new G4UIcmdWithADouble("/optics/implicitCapture", this);
+      fImplicitCaptureCmd->SetGuidance("Weighted transport: bulk (ABSLENGTH) & surface absorption only multiply the photon weight");
+      fImplicitCaptureCmd->SetGuidance("by the survival probability; Russian roulette below this weight floor. 0 (default): off");
+      fImplicitCaptureCmd->SetGuidance("Detection probability from the sumW column of the map");
+      fImplicitCaptureCmd->SetParameterName("weightFloor", false);
+      fImplicitCaptureCmd->SetRange("weightFloor >= 0 && weightFloor < 0.5");
+
+      fTpbSplittingCmd = new G4UIcmdWithAnInteger("/optics/tpbSplitting", this);
+      fTpbSplittingCmd->SetGuidance("Split every TPB conversion K times, each part w/ 1/K of the weight:");
+      fTpbSplittingCmd->SetGuidance("K fiber rolls for 128 nm photons on the shrouds, K isotropic photons for OpWLS (WLSR)");
+      fTpbSplittingCmd->SetGuidance("Default 1 (off). Use the sumW column of the map");
+      fTpbSplittingCmd->SetParameterName("K", false);
+      fTpbSplittingCmd->SetRange("K > 0");
+
+      fSplittingCapCmd = new G4UIcmdWithAnInteger("/optics/splittingCap", this);
+      fSplittingCapCmd->SetGuidance("Max nr of extra OpWLS photons per primary photon of an event (default 100); no splitting beyond");
+      fSplittingCapCmd->SetParameterName("N", false);
+      fSplittingCapCmd->SetRange("N >= 0");
+
+      fNeeCmd = new G4UIcmdWithAnInteger("/optics/nextEventEstimator", this);
+      fNeeCmd->SetGuidance("At every OpWLS re-emission add the expected detections of a direct flight to the shrouds");
+      fNeeCmd->SetGuidance("(LAr attenuation, fiberAtt, fiberDetProb; no other volumes block) to the nee column of the map");
+      fNeeCmd->SetGuidance("N x N quadrature cells over the shroud directions; 0 (default): off. L200 geometry only");
+      fNeeCmd->SetParameterName("N", false);
+      fNeeCmd->SetRange("N >= 0");
+
 
       fRecordAllStepsCmd = new G4UIcmdWithABool("/g4simple/recordAllSteps", this);
       fRecordAllStepsCmd->SetParameterName("recordAllSteps", true);
@@ -174,6 +232,10 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       delete fOutputOptionCmd;
       delete fRecordAllStepsCmd;
       delete fSetFiberAbsProbCmd;
+      delete fImplicitCaptureCmd;
+      delete fTpbSplittingCmd;
+      delete fSplittingCapCmd;
+      delete fNeeCmd;
     }
 
     void SetNewValue(G4UIcommand *command, G4String newValues) {
@@ -214,6 +276,18 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       }
      if(command == fSetFiberAbsProbCmd){
 	fiberAbsProb = fSetFiberAbsProbCmd->GetNewDoubleValue(newValues);
+      }
+      if(command == fImplicitCaptureCmd){
+	L200OpBoundaryProcess::setWeightFloor(fImplicitCaptureCmd->GetNewDoubleValue(newValues));	//static: all threads
+      }
+      if(command == fTpbSplittingCmd){
+	fSplitting = fTpbSplittingCmd->GetNewIntValue(newValues);
+      }
+      if(command == fSplittingCapCmd){
+	fSplittingCap = fSplittingCapCmd->GetNewIntValue(newValues);
+      }
+      if(command == fNeeCmd){
+	fNeeSteps = fNeeCmd->GetNewIntValue(newValues);
       }
 	  if(command == fSetVerboseCmd){
 		verbosity = fSetVerboseCmd->GetNewIntValue(newValues);
@@ -271,12 +345,8 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       man->AddNtupleRow();
     }
 
-    void UserSteppingAction(const G4Step *step) {
-		//NOW before everything else as we need volID in optical detection
-	  // post-step point will always work: only need to use the pre-step point
-      // on the first step, for which the pre-step volume is always the same as
-      // the post-step volume
-      G4VPhysicalVolume* vpv = step->GetPostStepPoint()->GetPhysicalVolume();
+    //volume ID from the /g4simple/setVolID patterns (cached per volume); -1: not sensitive
+    G4int volumeID(G4VPhysicalVolume* vpv) {
       G4int id = fVolIDMap[vpv];
       if(id == 0 && fPatternPairs.size() > 0) {
         string name = (vpv == NULL) ? "NULL" : vpv->GetName();
@@ -297,6 +367,34 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
         if(id == 0 && !fRecordAllSteps) id = -1;
         fVolIDMap[vpv] = id;
       }
+      return id;
+    }
+
+    void UserSteppingAction(const G4Step *step) {
+		//NOW before everything else as we need volID in optical detection
+	  // post-step point will always work: only need to use the pre-step point
+      // on the first step, for which the pre-step volume is always the same as
+      // the post-step volume
+      G4VPhysicalVolume* vpv = step->GetPostStepPoint()->GetPhysicalVolume();
+      G4int id = volumeID(vpv);
+
+      //primary photon of every track: the weights of all hits of one primary are squared together (sumW2)
+      G4Track* track = step->GetTrack();
+      if(track->GetCurrentStepNumber() == 1){
+	G4int eventID = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetEventID();
+	if(eventID != fRootEvent){
+		fRootOf.clear();
+		fHistoryOf.clear();
+		fClonesInEvent = 0;
+		fRootEvent = eventID;
+	}
+	fRootOf[track->GetTrackID()] = (track->GetParentID() == 0) ? track->GetTrackID() : fRootOf[track->GetParentID()];
+	if(mra->isRecordingDetections()){
+		PhotonHistory fresh = {0., 0., {0}};
+		fHistoryOf[track->GetTrackID()] = (track->GetParentID() == 0) ? fresh : fHistoryOf[track->GetParentID()];
+	}
+      }
+      G4int primary = fRootOf[track->GetTrackID()];
 
         //int verbosity = 4;		//wir haben dafür jetzt nen Command!
 
@@ -328,7 +426,18 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
     }
     if(boundary_proc &&
     step->GetTrack()->GetDefinition() == G4OpticalPhoton::OpticalPhotonDefinition()){
+	//implicit capture: bulk absorption only lowers the weight (OpAbsorption off, see MapRunAction::BeginOfRunAction)
+	G4double weightFloor = L200OpBoundaryProcess::getWeightFloor();
+	//adjoint mode (/scan/adjoint): photons from the shrouds, nothing is scored on the shrouds themselves
+	G4bool adjoint = fGenerator != NULL && fGenerator->getAdjointPhotons() > 0;
+	if(adjoint && adjointStep(step, primary)) return;
+	if(weightFloor > 0) applyBulkSurvival(step);
+	if(mra->isRecordingDetections()) addPath(step);
+	if(fNeeSteps > 0 && !adjoint) nextEventEstimate(step);	//before splitting: full weight of the shifted photon
+	if(fSplitting > 1 && !adjoint) splitWLS(step);
+
         L200OpBoundaryProcessStatus boundaryStatus=boundary_proc->GetStatus();
+	if(mra->isRecordingDetections()) countBounce(step, boundaryStatus);
 	G4double p = G4UniformRand();
 	switch(boundaryStatus){
         case Absorption:
@@ -355,13 +464,15 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 	    	   if(actualVolume == "innerShroud" || actualVolume == "outerShroud"){
 	    		if(preVolume == "larVolume"){
 					//See if the photon gets into the fiber and absorbed
-					if(p <= fiberAtt(step)*fiberDetProb){
+					G4double detProb = L200OpBoundaryProcess::getFiberHitProb();	//= fiberDetProb (may be swept)
+					if(!adjoint && p <= fiberAtt(step)*detProb){
 						if(verbosity>3){G4cout << "Yeees photon absorbed with a probabiltity of " << p << " < " << fiberAtt(step) << G4endl;}
-						mra->increment(fVolIDMap[step->GetPostStepPoint()->GetPhysicalVolume()]);
+						mra->increment(fVolIDMap[step->GetPostStepPoint()->GetPhysicalVolume()], step->GetTrack()->GetWeight(), primary);
+						recordDetection(step, step->GetTrack()->GetWeight(), primary);
 						step->GetTrack()->SetTrackStatus(fStopAndKill);
 					}
 					//Ok so it hit the fiber and didn't get absobed -> Kill it
-					else if(p<= fiberDetProb){
+					else if(p<= detProb){
 						step->GetTrack()->SetTrackStatus(fStopAndKill);
 						if(verbosity>3){G4cout << "Hit the shroud but was not absorbed -> KILL"<< G4endl;}
 					}
@@ -370,6 +481,16 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 		  	}
 		    }
 		}
+		//two-stage transport (/scan/wlsrTable): the TPB emission of the WLSR is taken from the table
+		else if(mra->getWlsrTable() != NULL && actualVolume == "wslrTPB" && preVolume == "larVolume"){
+			G4MaterialPropertiesTable* mpt = step->GetPostStepPoint()->GetMaterial()->GetMaterialPropertiesTable();
+			if(mpt != NULL && mpt->ConstPropertyExists("WLSMEANNUMBERPHOTONS")){
+				G4double expected = mpt->GetConstProperty("WLSMEANNUMBERPHOTONS")*mra->getWlsrTable()->lookup(step->GetPostStepPoint()->GetPosition());
+				mra->increment(1, step->GetTrack()->GetWeight()*expected, primary, false);	//volume ID 1 as in RunList; no count
+				step->GetTrack()->SetTrackStatus(fStopAndKill);
+				if(verbosity>3){G4cout << "Photon entered the WLSR TPB: "<<expected<<" expected detections from the table -> KILL"<< G4endl;}
+			}
+		}
 		else{
 		if(verbosity>3){G4cout << "Photon has WL of " << lambda/step->GetTrack()->GetKineticEnergy()/nm << " nm which is not blue -> Ignore "<< G4endl;}
 		}
@@ -421,10 +542,15 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 		//Here only roll for absorbtion since we already rolled in Boundary class for detection
 		 if(step->GetPostStepPoint()->GetPhysicalVolume() != step->GetPreStepPoint()->GetPhysicalVolume()){
 		//if(p <= fiberAbsProb){
+		//K independent rolls (splitting), 1st one w/ the p of the unsplit case
+		for(G4int k = 0; k < fSplitting && !adjoint; k++){
+		if(k > 0) p = G4UniformRand();
 		if(p <= fiberAtt(step)){
-				mra->increment(fVolIDMap[step->GetPostStepPoint()->GetPhysicalVolume()]);
+				mra->increment(fVolIDMap[step->GetPostStepPoint()->GetPhysicalVolume()], step->GetTrack()->GetWeight()/fSplitting, primary);
+				recordDetection(step, step->GetTrack()->GetWeight()/fSplitting, primary);
 								if(verbosity>3){G4cout << "Yeees 128 nm photon absorbed with a probabiltity of " << fiberAtt(step) << G4endl;}
 
+		}
 		}
 		step->GetTrack()->SetTrackStatus(fStopAndKill);
 }
@@ -433,6 +559,12 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 		if(verbosity>3)G4cout << "Unknown Photon-boundary-Action @ "<<actualVolume <<": "<<boundaryStatus<< G4endl;
             break;
       }
+
+	//Russian roulette below the weight floor: survivors get twice the floor (expectation unchanged)
+	if(weightFloor > 0 && track->GetTrackStatus() == fAlive && track->GetWeight() < weightFloor){
+		if(G4UniformRand()*2*weightFloor < track->GetWeight()) setWeight(step, 2*weightFloor);
+		else track->SetTrackStatus(fStopAndKill);
+	}
     }}
 
 		return;		//TODO dirty trick to shut off normal writing to not interfere with custom
@@ -597,15 +729,85 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       if(fOption == kStepWise) WriteRow(man);
     }
 
+    //new weight of the stepping track: G4Step::UpdateTrack copies the post step point weight onto the track every step
+    void setWeight(const G4Step *step, G4double weight){
+	step->GetTrack()->SetWeight(weight);
+	step->GetPostStepPoint()->SetWeight(weight);
+    }
+
+    //weight *= exp(-step length/ABSLENGTH) of the pre step material; photons made in this step (WLS) as well
+    void applyBulkSurvival(const G4Step *step){
+	G4MaterialPropertiesTable* mpt = step->GetPreStepPoint()->GetMaterial()->GetMaterialPropertiesTable();
+	G4MaterialPropertyVector* absLength = (mpt != NULL) ? mpt->GetProperty("ABSLENGTH") : NULL;
+	if(absLength == NULL) return;
+	G4double length = absLength->Value(step->GetPreStepPoint()->GetKineticEnergy());
+	G4double survival = (length > 0) ? exp(-step->GetStepLength()/length) : 0.;
+
+	setWeight(step, step->GetTrack()->GetWeight()*survival);
+	const vector<const G4Track*>* secondaries = step->GetSecondaryInCurrentStep();
+	for(size_t i = 0; secondaries != NULL && i < secondaries->size(); i++){
+		G4Track* secondary = const_cast<G4Track*>((*secondaries)[i]);
+		secondary->SetWeight(secondary->GetWeight()*survival);
+	}
+    }
+
+    //LAr path of the track, split by wavelength; both LAr materials share the absorption lengths
+    void addPath(const G4Step *step){
+	const G4String& material = step->GetPreStepPoint()->GetMaterial()->GetName();
+	if(material != "LiquidArgon" && material != "LiquidArgonFiber") return;
+	PhotonHistory& history = fHistoryOf[step->GetTrack()->GetTrackID()];
+	if(lambda/step->GetPreStepPoint()->GetKineticEnergy() > 400*nm) history.lVis += step->GetStepLength();
+	else history.lVUV += step->GetStepLength();
+    }
+
+    //reflection on one of the skin surfaces w/ a REFLECTIVITY (surface told apart by the material behind it)
+    void countBounce(const G4Step *step, L200OpBoundaryProcessStatus status){
+	if(status != LambertianReflection && status != LobeReflection && status != SpikeReflection && status != BackScattering) return;
+	const G4String& material = step->GetPostStepPoint()->GetPhysicalVolume()->GetLogicalVolume()->GetMaterial()->GetName();
+	G4int surface = (material == "G4_Cu") ? 0 : (material == "tetraTex") ? 1 : (material == "EnrichedGe") ? 2 : -1;
+	if(surface < 0) return;
+	G4bool blue = lambda/step->GetPreStepPoint()->GetKineticEnergy() > 400*nm;
+	fHistoryOf[step->GetTrack()->GetTrackID()].bounces[2*surface + (blue ? 1 : 0)]++;
+    }
+
+    void recordDetection(const G4Step *step, G4double weight, G4int primary){
+	if(!mra->isRecordingDetections()) return;
+	const PhotonHistory& history = fHistoryOf[step->GetTrack()->GetTrackID()];
+	mra->addDetection(weight, primary, history.lVUV, history.lVis, history.bounces);
+    }
+
+    //OpWLS photons of this step: K-1 isotropic copies (same place, time & energy) on the secondary stack,
+    //all K w/ 1/K of the weight; stops when the event used up fSplittingCap extra photons per primary
+    void splitWLS(const G4Step *step){
+	const vector<const G4Track*>* secondaries = step->GetSecondaryInCurrentStep();
+	if(secondaries == NULL) return;
+	G4int nrPrimaries = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetNumberOfPrimaryVertex();
+	for(size_t i = 0; i < secondaries->size(); i++){
+		const G4Track* original = (*secondaries)[i];
+		if(original->GetCreatorProcess() == NULL || original->GetCreatorProcess()->GetProcessName() != "OpWLS") continue;
+		if(fClonesInEvent + fSplitting-1 > fSplittingCap*nrPrimaries) return;
+		G4double weight = original->GetWeight()/fSplitting;
+		const_cast<G4Track*>(original)->SetWeight(weight);
+		for(G4int k = 1; k < fSplitting; k++){
+			G4ThreeVector dir = G4RandomDirection();
+			G4ThreeVector pol = dir.orthogonal().unit();
+			pol.rotate(twopi*G4UniformRand(), dir);
+			G4DynamicParticle* photon = new G4DynamicParticle(G4OpticalPhoton::OpticalPhoton(), dir, original->GetKineticEnergy());
+			photon->SetPolarization(pol.x(), pol.y(), pol.z());
+			G4Track* clone = new G4Track(photon, original->GetGlobalTime(), original->GetPosition());
+			clone->SetParentID(original->GetParentID());
+			clone->SetTouchableHandle(original->GetTouchableHandle());
+			clone->SetCreatorProcess(original->GetCreatorProcess());
+			clone->SetWeight(weight);
+			fpSteppingManager->GetfSecondary()->push_back(clone);	//tracked like the other secondaries of this track
+			fClonesInEvent++;
+		}
+	}
+    }
+
     //Based on bachelor thesis Patrick Krause
     G4double fiberAtt(const G4Step *step){
 
-	const G4double I1 = 0.042; //trapped in core prob
-	const G4double I2 = 0.068; //trapped in core + first cladding prob
-	const G4double I3 = 0.209; //trapped in core + first cladding + second cladding prob
-	const G4double attL =3900*mm;
-	const G4double attS =225*mm;
-
 	G4Tubs* shroud = dynamic_cast<G4Tubs*>( step->GetPostStepPoint()->GetPhysicalVolume()->GetLogicalVolume()->GetSolid());
 	G4double fiberLengthHalf = shroud->GetZHalfLength();
 	G4ThreeVector trans = step->GetPostStepPoint()->GetPhysicalVolume()->GetTranslation();
@@ -616,7 +818,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 
 	if(G4UniformRand()<=0.5)
 		x= 2.*fiberLengthHalf-curZ;
-	G4double intensity =I2*exp(-x/attL) + (I3 - I2)*exp(-x/attS);
+	G4double intensity = fiberIntensity(x);
 
 	if(verbosity>3){
 		G4cout << "Investigate the photon at z+fiberLengthHalf: " << curZ << G4endl;
@@ -627,22 +829,137 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 
     }
 
+    //adjoint step: drops forward OpWLS photons (returns true then), reverse TPB step for 450 nm photons in the WLSR TPB,
+    //track length tally for 128 nm photons in the LAr
+    G4bool adjointStep(const G4Step *step, G4int primary){
+	G4Track* track = step->GetTrack();
+	if(track->GetCurrentStepNumber() == 1 && track->GetCreatorProcess() != NULL && track->GetCreatorProcess()->GetProcessName() == "OpWLS"){
+		track->SetTrackStatus(fStopAndKill);	//128 nm adjoint photon absorbed in the TPB: ends there
+		return true;
+	}
+	G4StepPoint* pre = step->GetPreStepPoint();
+	G4String preVolume = pre->GetPhysicalVolume()->GetName();
+	if(lambda/pre->GetKineticEnergy() > 400*nm){
+		if(preVolume == "wslrTPB") reverseTPB(step);
+	}
+	else if(preVolume == "larVolume") tallyTrackLength(step, primary);
+	return false;
+    }
+
+    //TPB in reverse: a 128 nm photon absorbed in the WLSR TPB gives WLSMEANNUMBERPHOTONS isotropic 450 nm ones, so the
+    //450 nm adjoint flux in the TPB (track length/thickness) times WLSMEANNUMBERPHOTONS/4 leaves as 128 nm adjoint photons
+    //w/ the cosine law. They start just inside the LAr (Fresnel loss TPB -> LAr neglected)
+    void reverseTPB(const G4Step *step){
+	G4StepPoint* pre = step->GetPreStepPoint();
+	G4MaterialPropertiesTable* mpt = pre->GetMaterial()->GetMaterialPropertiesTable();
+	G4Tubs* tpb = dynamic_cast<G4Tubs*>(pre->GetPhysicalVolume()->GetLogicalVolume()->GetSolid());
+	if(mpt == NULL || tpb == NULL || !mpt->ConstPropertyExists("WLSMEANNUMBERPHOTONS")) return;	//black WLSR
+	G4double thickness = tpb->GetOuterRadius() - tpb->GetInnerRadius();
+	G4double weight = pre->GetWeight()*step->GetStepLength()/thickness*mpt->GetConstProperty("WLSMEANNUMBERPHOTONS")/4.;
+	if(weight <= 0) return;
+
+	G4ThreeVector trans = pre->GetPhysicalVolume()->GetTranslation();
+	G4ThreeVector local = 0.5*(pre->GetPosition() + step->GetPostStepPoint()->GetPosition()) - trans;
+	G4ThreeVector inward = -G4ThreeVector(local.x(), local.y(), 0).unit();
+	G4ThreeVector pos = trans - (tpb->GetInnerRadius() - 1e-3*mm)*inward + G4ThreeVector(0, 0, local.z());
+	G4ThreeVector dir = L200ParticleGenerator::LambertianDirection(inward);
+	G4ThreeVector pol = dir.orthogonal().unit();
+	pol.rotate(twopi*G4UniformRand(), dir);
+
+	G4DynamicParticle* photon = new G4DynamicParticle(G4OpticalPhoton::OpticalPhoton(), dir, lambda/(128*nm));
+	photon->SetPolarization(pol.x(), pol.y(), pol.z());
+	G4Track* vuv = new G4Track(photon, step->GetPostStepPoint()->GetGlobalTime(), pos);
+	vuv->SetParentID(step->GetTrack()->GetTrackID());
+	vuv->SetWeight(weight);
+	fpSteppingManager->GetfSecondary()->push_back(vuv);	//located by the navigator when its tracking starts
+    }
+
+    //adjoint tally: weight x length of a LAr step per grid voxel, in pieces of 1/4 of the smallest grid pitch
+    void tallyTrackLength(const G4Step *step, G4int primary){
+	G4ThreeVector start = step->GetPreStepPoint()->GetPosition();
+	G4ThreeVector delta = step->GetPostStepPoint()->GetPosition() - start;
+	G4double length = delta.mag();
+	G4double piece = 0.25*fGenerator->getMinGridWidth();
+	if(length <= 0 || piece <= 0) return;
+	G4int n = std::min(1000, (G4int)std::ceil(length/piece));
+	G4double value = step->GetPreStepPoint()->GetWeight()*length/n;
+	G4int voxel = -1;
+	G4double sum = 0;
+	for(G4int i = 0; i < n; i++){
+		G4int index = fGenerator->gridIndexAt(start + (i + 0.5)/n*delta);
+		if(index != voxel){
+			if(voxel >= 0) mra->addTrackLength(voxel, sum, primary);
+			voxel = index;
+			sum = 0;
+		}
+		sum += value;
+	}
+	if(voxel >= 0) mra->addTrackLength(voxel, sum, primary);
+    }
+
+    //light reaching one fiber end after x in the fiber (shared w/ the adjoint source of the generator)
+    G4double fiberIntensity(G4double x){
+	return L200OpBoundaryProcess::fiberIntensity(x);
+    }
+
+    //next-event estimate: expected detections of an isotropic 450 nm photon @ pos w/ a direct flight to a shroud,
+    //midpoint rule on fNeeSteps^2 cells of the (cos theta, phi) box of the shrouds; fiberAtt averaged over both ends
+    void nextEventEstimate(const G4Step *step){
+	if(!fDetectorLookedUp){
+		fDetector = dynamic_cast<L200DetectorConstruction*>(const_cast<G4VUserDetectorConstruction*>(G4RunManager::GetRunManager()->GetUserDetectorConstruction()));
+		fDetectorLookedUp = true;
+	}
+	if(fDetector == NULL) return;
+	const vector<const G4Track*>* secondaries = step->GetSecondaryInCurrentStep();
+	if(secondaries == NULL) return;
+	G4double absVis = fDetector->getlArAbsVis();
+	G4double detProb = L200OpBoundaryProcess::getFiberHitProb();
+	for(size_t i = 0; i < secondaries->size(); i++){
+		const G4Track* photon = (*secondaries)[i];
+		if(photon->GetCreatorProcess() == NULL || photon->GetCreatorProcess()->GetProcessName() != "OpWLS") continue;
+		G4ThreeVector pos = photon->GetPosition();
+		G4double cosMin, cosMax, phiMin, phiWidth;
+		fDetector->GetShroudAngularBox(pos, cosMin, cosMax, phiMin, phiWidth);
+		G4double dCos = (cosMax - cosMin)/fNeeSteps;
+		G4double dPhi = phiWidth/fNeeSteps;
+		if(dCos <= 0) continue;
+		map<const G4VPhysicalVolume*, G4double> expected;
+		for(G4int iCos = 0; iCos < fNeeSteps; iCos++){
+			G4double cosTheta = cosMin + (iCos + 0.5)*dCos;
+			G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+			for(G4int iPhi = 0; iPhi < fNeeSteps; iPhi++){
+				G4double phi = phiMin + (iPhi + 0.5)*dPhi;
+				G4ThreeVector dir(sinTheta*cos(phi), sinTheta*sin(phi), cosTheta);
+				G4double length, z, halfHeight;
+				const G4VPhysicalVolume* shroud = fDetector->HitShroud(pos, dir, length, z, halfHeight);
+				if(shroud == NULL) continue;
+				G4double transmission = (absVis > 0) ? exp(-length/absVis) : 1.;
+				expected[shroud] += transmission*0.5*(fiberIntensity(z) + fiberIntensity(2.*halfHeight - z));
+			}
+		}
+		for(map<const G4VPhysicalVolume*, G4double>::const_iterator it = expected.begin(); it != expected.end(); ++it){
+			G4int volID = volumeID(const_cast<G4VPhysicalVolume*>(it->first));
+			if(volID > 0) mra->addExpected(volID, photon->GetWeight()*it->second*detProb*dCos*dPhi/(4*pi));
+		}
+	}
+    }
+
 };		//END of Stepping Action Class Definition/Declaration
 
 
 class G4SimplePrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction, public G4UImessenger
 {
   public:
-    G4SimplePrimaryGeneratorAction(){
-      gen = new L200ParticleGenerator;
-
+    //ownsGen false: generator belongs to G4SimpleActionInitialization (the one RunList steers)
+    G4SimplePrimaryGeneratorAction(L200ParticleGenerator* generator, G4bool ownsGen)
+    : gen(generator), ownsGen(ownsGen) {
       fToggleGeneratorCmd = new G4UIcmdWithABool("/g4simple/toggleL200Gen", this);
       fToggleGeneratorCmd->SetDefaultValue(true);
       fToggleGeneratorCmd->SetGuidance("Set if the L200ParticleGenerator is used (if so, no beamOn command, and g4simple is started with two options only)");
       useGen = true;
     }
     ~G4SimplePrimaryGeneratorAction(){
-      delete gen;
+      if(ownsGen) delete gen;
       delete fToggleGeneratorCmd;
     }
     void GeneratePrimaries(G4Event* event) {
@@ -662,11 +979,69 @@ class G4SimplePrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction, pub
   private:
     G4GeneralParticleSource fParticleGun;
     L200ParticleGenerator* gen;
+    G4bool ownsGen;
     G4UIcmdWithABool* fToggleGeneratorCmd;
     G4bool useGen;
 };
 
 
+//Builds the user actions. Sequential: one set steered directly by RunList.
+//MT (G4SIMPLE_MT): RunList steers the master generator & master MapRunAction; every worker
+//gets its own generator copy (reading the master's voxel), stepping action and MapRunAction
+//(merged into the master one @ EndOfRunAction).
+class G4SimpleActionInitialization : public G4VUserActionInitialization
+{
+  public:
+    G4SimpleActionInitialization()
+    : masterGen(new L200ParticleGenerator), masterMRA(new MapRunAction(1))	//TODO: how many volumes?
+    {
+#ifdef G4SIMPLE_MT
+      //never used for tracking: only keeps the /g4simple/ & /optics/ commands of the worker
+      //actions known to the master UI, which broadcasts them to the workers
+      masterPGA = new G4SimplePrimaryGeneratorAction(masterGen, false);
+      masterSA = new G4SimpleSteppingAction(masterMRA, masterGen);
+#endif
+    }
+    virtual ~G4SimpleActionInitialization(){
+#ifdef G4SIMPLE_MT
+      delete masterPGA;
+      delete masterSA;
+#endif
+      delete masterGen;
+      //masterMRA is deleted by the run manager
+    }
+
+    virtual void BuildForMaster() const {
+      SetUserAction(masterMRA);
+    }
+
+    virtual void Build() const {
+#ifdef G4SIMPLE_MT
+      L200ParticleGenerator* gen = new L200ParticleGenerator(masterGen);
+      SetUserAction(new G4SimplePrimaryGeneratorAction(gen, true));
+      MapRunAction* mra = new MapRunAction(1, masterMRA);
+#else
+      L200ParticleGenerator* gen = masterGen;
+      SetUserAction(new G4SimplePrimaryGeneratorAction(gen, false));
+      MapRunAction* mra = masterMRA;
+#endif
+      SetUserAction(mra);
+      SetUserAction(new G4SimpleSteppingAction(mra, gen));
+    }
+
+    L200ParticleGenerator* getGenerator() const { return masterGen; }
+    MapRunAction* getMapRunAction() const { return masterMRA; }
+
+  private:
+    L200ParticleGenerator* masterGen;
+    MapRunAction* masterMRA;
+#ifdef G4SIMPLE_MT
+    G4SimplePrimaryGeneratorAction* masterPGA;
+    G4SimpleSteppingAction* masterSA;
+#endif
+};
+
+
 class G4SimpleDetectorConstruction : public G4VUserDetectorConstruction
 {
   public:
@@ -677,7 +1052,13 @@ class G4SimpleDetectorConstruction : public G4VUserDetectorConstruction
 };
 
 
-class G4SimpleRunManager : public G4RunManager, public G4UImessenger
+#ifdef G4SIMPLE_MT
+typedef G4MTRunManager G4SimpleRunManagerBase;	//photons of one voxel are spread over the worker threads
+#else
+typedef G4RunManager G4SimpleRunManagerBase;
+#endif
+
+class G4SimpleRunManager : public G4SimpleRunManagerBase, public G4UImessenger
 {
   private:
     G4UIdirectory* fDirectory;
@@ -698,6 +1079,7 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
 
       fPhysListCmd = new G4UIcmdWithAString("/g4simple/setReferencePhysList", this);
       fPhysListCmd->SetGuidance("Set reference physics list to be used");
+      fPhysListCmd->SetToBeBroadcasted(false);
 
       fDetectorCmd = new G4UIcommand("/g4simple/setDetectorGDML", this);
       fDetectorCmd->SetParameter(new G4UIparameter("filename", 's', false));
@@ -705,26 +1087,31 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
       validatePar->SetDefaultValue("true");
       fDetectorCmd->SetParameter(validatePar);
       fDetectorCmd->SetGuidance("Provide GDML filename specifying the detector construction");
+      fDetectorCmd->SetToBeBroadcasted(false);
 
       fTGDetectorCmd = new G4UIcommand("/g4simple/setDetectorTGFile", this);
       fTGDetectorCmd->SetParameter(new G4UIparameter("filename", 's', false));
       fTGDetectorCmd->SetGuidance("Provide text filename specifying the detector construction");
+      fTGDetectorCmd->SetToBeBroadcasted(false);
 
       fRandomSeedCmd = new G4UIcmdWithABool("/g4simple/setRandomSeed", this);
       fRandomSeedCmd->SetParameterName("useURandom", true);
       fRandomSeedCmd->SetDefaultValue(false);
       fRandomSeedCmd->SetGuidance("Seed random number generator with a read from /dev/random");
       fRandomSeedCmd->SetGuidance("Set useURandom to true to read instead from /dev/urandom (faster but less random)");
+      fRandomSeedCmd->SetToBeBroadcasted(false);	//MT: workers are seeded from the master engine
 
       fListVolsCmd = new G4UIcmdWithAString("/g4simple/listPhysVols", this);
       fListVolsCmd->SetParameterName("pattern", true);
       fListVolsCmd->SetGuidance("List name of all instantiated physical volumes");
       fListVolsCmd->SetGuidance("Optionally supply a regex pattern to only list matching volume names");
       fListVolsCmd->AvailableForStates(G4State_Idle, G4State_GeomClosed, G4State_EventProc);
+      fListVolsCmd->SetToBeBroadcasted(false);
 
       fSetFiberDetProbCmd = new G4UIcmdWithADouble("/optics/fiberDetProb", this);
       fSetFiberDetProbCmd->SetDefaultValue(0.6);
       fSetFiberDetProbCmd->SetGuidance("Set the detection probability of the fiber shrouds (coverage)!");
+      fSetFiberDetProbCmd->SetToBeBroadcasted(false);	//global, shared by all threads
       fiberDetProb = 0.;
 
 }
@@ -745,6 +1132,7 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
 
       if(command == fSetFiberDetProbCmd){
 	fiberDetProb = fSetFiberDetProbCmd->GetNewDoubleValue(newValues);
+	L200OpBoundaryProcess::setFiberHitProb(fiberDetProb);
       }
       else if(command == fPhysListCmd) {
 		G4VModularPhysicsList* gvmpl = (new G4PhysListFactory)->GetReferencePhysList(newValues);
@@ -769,13 +1157,10 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
 		gvmpl->RegisterPhysics(fp);
 
         SetUserInitialization(gvmpl);
-		G4SimplePrimaryGeneratorAction* gspga = new G4SimplePrimaryGeneratorAction();
-        SetUserAction(gspga); // must come after phys list
-		MapRunAction* mra = new MapRunAction(1);	//TODO: how many volumes?
-		SetUserAction(mra);
-        SetUserAction(new G4SimpleSteppingAction(mra)); // must come after phys list
+		G4SimpleActionInitialization* gsai = new G4SimpleActionInitialization();
+        SetUserInitialization(gsai); // must come after phys list
 
-		runList = new RunList(gspga->getGenerator(), mra);//last but not least
+		runList = new RunList(gsai->getGenerator(), gsai->getMapRunAction());//last but not least
       }
       else if(command == fDetectorCmd) {
         istringstream iss(newValues);
@@ -838,10 +1223,12 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
       }
     }
 
-	void autorun(){
+	void autorun(G4int workerProcesses = 0, G4bool preview = false){
 		if(runList == NULL){
 			G4Exception("G4SimpleRunManager::autorun","noRunList",RunMustBeAborted,"no runList here. Did you make some bad stuff in your macro?");
 		}else{
+			runList->setWorkerProcesses(workerProcesses);
+			runList->setPreview(preview);
 			runList->startRuns();
 		}
 	};
@@ -851,15 +1238,37 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
 
 int main(int argc, char** argv)
 {
-  if(argc > 3) {
-    cout << "Usage: " << argv[0] << " [macro]" << "[--vis]" << endl;
+  //--workers N: fork N processes after /run/initialize (see RunList::runWorkerPool)
+  //--preview: deterministic approximate map instead of the simulation (see PreviewSolver)
+  int workerProcesses = 0;
+  bool preview = false;
+  vector<char*> args;
+  for(int i = 0; i < argc; i++) {
+    if(string(argv[i]) == "--workers" && i+1 < argc) workerProcesses = atoi(argv[++i]);
+    else if(string(argv[i]) == "--preview") preview = true;
+    else args.push_back(argv[i]);
+  }
+  argc = args.size();
+  argv = &args[0];
+
+  if(argc > 3 || workerProcesses < 0) {
+    cout << "Usage: " << argv[0] << " [macro]" << "[--vis]" << "[--workers N]" << "[--preview]" << endl;
+    return 1;
+  }
+#ifdef G4SIMPLE_MT
+  if(workerProcesses > 0) {
+    cout << "--workers needs a sequential build (WITH_MT=OFF); use /run/numberOfThreads instead" << endl;
     return 1;
   }
+#endif
 
 
 
 
   G4SimpleRunManager* runManager = new G4SimpleRunManager;
+#ifdef G4SIMPLE_MT
+  runManager->SetNumberOfThreads(G4Threading::G4GetNumberOfCores());	//override via /run/numberOfThreads
+#endif
   G4VisManager* visManager = new G4VisExecutive;
   visManager->Initialize();
 
@@ -867,7 +1276,7 @@ int main(int argc, char** argv)
   else G4UImanager::GetUIpointer()->ApplyCommand(G4String("/control/execute ")+argv[1]);
 
   if(argc == 2)
-	runManager->autorun();
+	runManager->autorun(workerProcesses, preview);
 
 #ifdef GDMLOUT
 	//only for test. Will have to find better position to vomit out gdml only on request
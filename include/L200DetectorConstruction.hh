@@ -7,6 +7,9 @@
 #include "Randomize.hh"
 #include "globals.hh"
 #include "G4AssemblyVolume.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
 
 #include "L200DetectorMessenger.hh"
 
@@ -71,12 +74,39 @@ public:
 
 	void setBlackWLSR(G4bool flag){wlsrBlack = flag;};
 
+	//optical parameter sweeps (RunList): only touches the LAr property table, no geometry/material rebuild
+	void UpdateLArOptics();	//refills ABSLENGTH & RAYLEIGH from lArAbsVUV, lArAbsVis, lArRay
+	G4double getlArAbsVUV(){return lArAbsVUV;};
+	G4double getlArAbsVis(){return lArAbsVis;};
+	G4bool getlArRay(){return lArRay;};
+
+	//closed form of "point is in larVolume" (i.e. not in cryostat wall, shrouds, WLSR or Ge) from the
+	//dimensions above; used by L200ParticleGenerator instead of a navigator lookup. Valid after Construct()
+	G4bool IsInLAr(const G4ThreeVector& p) const;
+	//box in (cos theta, phi) seen from p that contains both fiber shrouds (conservative, not tight);
+	//phi from phiMin to phiMin+phiWidth (2 pi if p is inside the outer shroud radius)
+	void GetShroudAngularBox(const G4ThreeVector& p, G4double& cosMin, G4double& cosMax, G4double& phiMin, G4double& phiWidth) const;
+	//first fiber shroud a ray from p (outside the shrouds) along the unit vector dir enters; NULL if none. length: distance
+	//to the entry point, zFromBottom: height of the entry point above the bottom of that shroud. No other volume blocks the ray
+	const G4VPhysicalVolume* HitShroud(const G4ThreeVector& p, const G4ThreeVector& dir, G4double& length, G4double& zFromBottom, G4double& halfHeight) const;
+	//point uniform in area on the 4 cylinder walls of the fiber shrouds (end rings left out); normal: unit vector
+	//into the LAr, zFromBottom & halfHeight as above. Returns the total area of the walls (adjoint source)
+	G4double SampleShroudSurface(G4ThreeVector& p, G4ThreeVector& normal, G4double& zFromBottom, G4double& halfHeight) const;
+	//TPB layer of the WLSR (tube btw. innerR & outerR, z from zCenter-halfHeight to zCenter+halfHeight).
+	//false if there is none (black WLSR or not built). Valid after Construct()
+	G4bool GetWLSRTPB(G4double& innerR, G4double& outerR, G4double& zCenter, G4double& halfHeight) const;
+	//TPB photons per absorbed VUV photon (WLSMEANNUMBERPHOTONS) & Tetratex reflectivity @ tpbWL; false as above
+	G4bool GetWLSROptics(G4double& tpbYield, G4double& reflectivity) const;
+	//REFLECTIVITY of the Cu, Tetratex & Ge skin surfaces (in this order) @ tpbWL (vis) & lArWL (vuv); -1 if not built
+	void GetReflectivities(G4double vis[3], G4double vuv[3]) const;
+
 	void setGeDiscHeight(G4double val){geDiscHeight = val;};
 	void setGeDiscRad(G4double val){geDiscRad = val;};
 	void setGeDiscGap(G4double val){geDiscGap = val;};
 	void setGeArrayRad(G4double val){geArrayRad = val;};
 	void setNrGeDetPerString(G4int val){geDetectorsInString = val;};
 	void setNrGeStrings(G4int val){geStringCount = val;};
+	G4int getNrGeStrings() const {return geStringCount;};	//strings @ phi = i*360°/n --> mirror symmetric wedges of 180°/n
 
 
 protected:
@@ -105,6 +135,11 @@ protected:
 
 	//Optical properties
 	G4double LArAttVUV;
+	G4MaterialPropertiesTable* lArMPT;	//shared by lAr_mat & lAr_mat_fiber
+
+	//z planes (descending) & outer radii of the larVolume polycone as built in FillLAr (for IsInLAr)
+	std::vector<G4double> lArPlaneZ;
+	std::vector<G4double> lArPlaneR;
 
 	//primäre Dimensionen (zwischenwerte werden in CostructDetector() angelegt und berechnet)
 	//alle Längen sind NICHT halbiert
@@ -13,13 +13,12 @@ public:
 	virtual void ConstructProcess();
 
 	//Magic setter
-	void setFiberHitProb(G4double value){theProb = value;}
+	void setFiberHitProb(G4double value){L200OpBoundaryProcess::setFiberHitProb(value);}	//static there; not reset per thread
 	void setMagicMaterialName(G4String value){theTPBMagicMaterialName = value;}
 	void setLArWL(G4double value){theLArWL = value;}
 
 private:
-	L200OpBoundaryProcess* fL200OpBoundaryProcess;
-	G4double theProb;
+	static G4ThreadLocal L200OpBoundaryProcess* fL200OpBoundaryProcess;	//one per thread; ConstructProcess runs on every worker
 	G4String theTPBMagicMaterialName;
 	G4double theLArWL;
 };
@@ -103,7 +103,17 @@ public:
         // Returns the current status.
 
 	//Magic setter
-	void setFiberHitProb(G4double value){theProb = value;}
+	//fiber hit prob is shared by all threads & instances (changed between runs by /sweep/fiberDetProb)
+	static void setFiberHitProb(G4double value){theProb = value;}
+	static G4double getFiberHitProb(){return theProb;}
+	//light reaching one fiber end after x in the fiber (bachelor thesis Patrick Krause)
+	static G4double fiberIntensity(G4double x);
+	//implicit capture (/optics/implicitCapture): surfaces that cannot detect never absorb, the photon
+	//weight is multiplied by the reflectivity instead; 0 (default): off. Shared by all threads
+	static void setWeightFloor(G4double value){theWeightFloor = value;}
+	static G4double getWeightFloor(){return theWeightFloor;}
+	//OpAbsorption of optical photons on the calling thread: off w/ implicit capture (BeginOfRunAction, every thread)
+	static void applyWeightFloor();
 	void setMagicMaterialName(G4String value){theTPBMagicMaterialName = value;}
 	void setLArWL(G4double value){theLArWL = value;}
 
@@ -121,6 +131,7 @@ private:
         void ChooseReflection();
         void DoAbsorption();
         void DoReflection();
+        G4bool SurfaceAbsorbs();	//absorption roll (or weight factor w/ implicit capture)
 
         G4double GetIncidentAngle();
         // Returns the incident angle of optical photon
@@ -178,7 +189,9 @@ private:
 
         //Magic TPB variables
 	G4double kCarTolerance;
-	G4double theProb;
+	static G4double theProb;
+	static G4double theWeightFloor;
+	G4double theWeightFactor;	//product of the reflectivities of this step (implicit capture)
 	G4String theTPBMagicMaterialName;
 	G4double theLArWL;
 
@@ -250,6 +263,16 @@ void L200OpBoundaryProcess::DoAbsorption()
               aParticleChange.ProposeTrackStatus(fStopAndKill);
 }
 
+inline
+G4bool L200OpBoundaryProcess::SurfaceAbsorbs()
+{
+        if ( theWeightFloor <= 0 || theEfficiency > 0 || theReflectivity <= 0 )
+           return !G4BooleanRand(theReflectivity);
+
+        theWeightFactor *= theReflectivity;
+        return false;
+}
+
 inline
 void L200OpBoundaryProcess::DoReflection()
 {
@@ -8,6 +8,11 @@
 #include "G4ThreeVector.hh"
 #include "G4LogicalVolume.hh"
 
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <string>
 
 //---------------------------------------------------------------------------//
 
@@ -15,15 +20,41 @@ class G4Event;
 class L200ParticleGeneratorMessenger;
 class G4ParticleGun;
 class G4Run;
+class G4Navigator;
+class L200DetectorConstruction;
 
 class L200ParticleGenerator
 {
 
   public:
 
+	//record of /generator/pointFile (native byte order, 32 bytes): one emission point w/ zero size
+	struct PointRecord{
+		G4double x, y, z;		//mm
+		uint32_t nPhotons;		//0: SetNParticles
+		uint32_t reserved;
+	};
+
 	struct Voxel{
 		G4double xPos, yPos, zPos;	//all lower points; i.e. x from xPos to xWid, ...
-		G4double xWid, yWid, zWid;		//TODO currently unused; need to be implemented for oblong vxels
+		G4double xWid, yWid, zWid;		//fBinWidth on the regular grid; smaller after refinement (/scan/adaptive)
+		uint32_t index;		//flat voxel index (identical for all shards; used for seeding & merging)
+							//refined voxels: counted on from the grid size
+		G4bool polar = false;	//polar grid: x -> r, y -> phi (rad), z -> z around the z axis
+		uint32_t nPhotons = 0;	//photons to shoot (/generator/pointFile); 0: SetNParticles
+
+		G4ThreeVector pointAt(G4double u, G4double v, G4double w) const {	//u,v,w in [0,1]
+			if(polar){	//u uniform in r^2: equal volumes for equal steps in u
+				G4double r = std::sqrt(xPos*xPos + u*((xPos+xWid)*(xPos+xWid) - xPos*xPos));
+				G4double phi = yPos + v*yWid;
+				return G4ThreeVector(r*std::cos(phi), r*std::sin(phi), zPos + w*zWid);
+			}
+			return G4ThreeVector(xPos + u*xWid, yPos + v*yWid, zPos + w*zWid);
+		};
+		G4double volume() const {
+			if(polar) return 0.5*yWid*((xPos+xWid)*(xPos+xWid) - xPos*xPos)*zWid;
+			return xWid*yWid*zWid;
+		};
 
 		friend std::ostream& operator<<(std::ostream& os, const Voxel& vx){
 			os << "("<<vx.xPos<<","<<vx.yPos<<","<<vx.zPos<<")";
@@ -31,14 +62,18 @@ class L200ParticleGenerator
 		};
 	};
 
-    L200ParticleGenerator();
+    L200ParticleGenerator(L200ParticleGenerator* master = NULL);	//master != NULL: worker thread copy (MT), no own messenger
     ~L200ParticleGenerator();
 
     void GeneratePrimaryVertex(G4Event *event);
     void SetParticlePosition(G4ThreeVector pos) { fCurrentPosition = pos;}
-    void DirectionDecider();
-    void PositionDecider(G4double x,G4double y,G4double z,G4double binWidth);
-    G4bool IsInArgon(G4ThreeVector rp);
+    void DirectionDecider(const G4double* qmc = NULL);	//qmc: (cos theta, phi) in [0,1) instead of random numbers
+    void PositionDecider(const Voxel& voxel, uint64_t* occupancy = NULL, const G4double* qmc = NULL);	//occupancy: only in LAr sub-cells (w/o LAr found: bit cleared)
+																											//qmc: u,v,w of the 1st try
+    G4double BiasedDirectionDecider();	//importance sampling towards the fiber shrouds seen from fCurrentPosition
+										//returns the statistical weight of the direction (isotropic / sampled density)
+    G4bool IsInArgon(G4ThreeVector rp);	//see argonClassifier
+    static G4ThreeVector LambertianDirection(const G4ThreeVector& normal);	//cosine law around the unit vector normal
 
     //Messenger Commands
     void SetRadius(G4double r){fRadiusMax = r;}
@@ -46,10 +81,37 @@ class L200ParticleGenerator
     void SetHeight(G4double h){fZ = h;}
     void SetCenterVector(G4ThreeVector vec){fCenterVector = vec;}
     void SetBinWidth(G4double width) {fBinWidth = width;}
+    void SetPolarGrid(G4bool flag) {polarGrid = flag;}
+    G4bool isPolarGrid() {return polarGrid;}
+    void SetRadialWidth(G4double width) {fRadialWidth = width;}	//polar grid pitches; 0: fBinWidth (phi: whole wedge)
+    void SetPhiWidth(G4double width) {fPhiWidth = width;}
+    void SetZWidth(G4double width) {fZWidth = width;}
     void SetNParticles(G4double N) {fNParticles = N;}
+    void SetPointFile(G4String path);	//"" closes it (back to the grid)
+    G4bool hasPointFile() {return pointRecords != NULL;}
+    void SetPhotonsPerEvent(G4int N) {photonsPerEvent = (N > 0) ? N : 1;}
+    void SetTargetRelError(G4double err) {targetRelError = err;}
+    void SetMaxPhotons(G4double N) {maxPhotons = N;}
+    void SetQmc(G4bool flag) {useQmc = flag;}
+    void SetQmcReplicates(G4int R) {qmcReplicates = (R > 0) ? R : 1;}
+    void SetImportanceSampling(G4double fraction) {importanceFraction = std::max(0., std::min(1., fraction));}
+    G4double getImportanceSampling() {return importanceFraction;}
     void setDimScan(G4int b){fDim =b;}
 	void setVerbosity(G4int verbose){verbosity = verbose;};
 	void setAbortOnNonlar(G4bool flag){abortOnNonlar = flag;};
+	void setShard(G4int index, G4int count);	//only visit every count-th (non-skipped) voxel, starting with the index-th
+	//IsInArgon: analytic (L200DetectorConstruction::IsInLAr; private navigator for other geometries),
+	//navigator (private G4Navigator, volume name "larVolume") or crosscheck (both, reports disagreements)
+	enum ArgonClassifier {analyticClassifier, navigatorClassifier, crosscheckClassifier};
+	void setArgonClassifier(G4int mode){argonClassifier = mode;};
+	void setOccupancyMask(G4bool flag){useOccupancyMask = flag;};
+	void setOccupancyCache(G4String file){occupancyCache = file;};
+
+	//scan cursor (checkpoint/resume in RunList)
+	uint32_t getFlatVoxelIndex(){return flatVoxelIndex;};
+	uint32_t getValidVoxelCount(){return validVoxelCount;};
+	long getSeedBase(){return seedBase;};
+	void setCursor(uint32_t flatIndex, uint32_t validCount, long seed);	//next nextVoxel() continues from flatIndex
 
 	//methods called from above (RunList)
 	//to be called BEFORE STARTING ANY RUN!!!
@@ -58,9 +120,74 @@ class L200ParticleGenerator
 							// return 0 --> end runs
 
 	Voxel getCurrentVoxel() {return currentVoxel;};
+	void setCurrentVoxel(const Voxel& voxel);	//runs an arbitrary voxel next (adaptive refinement); cursor untouched
+	G4bool isInScanRegion(const Voxel& voxel);	//symmetry wedge & radius check of nextVoxel
+	void getScanAxes(G4bool& x, G4bool& y, G4bool& z);	//axes scanned for the current SetDimension
+	uint32_t getGridSize(){return gridSize;};	//nr of flat indices of the regular grid (valid after 1st nextVoxel)
+	G4int getShardCount(){return shardCount;};
+	G4double getScanAngle(){updateScanAngle(); return scanAngle;};	//symmetry wedge (written to the meta ntuple)
 	G4bool isCurrentVoxelAborted(){return abortVoxel;};
+	uint64_t getOccupancy(uint32_t index);	//LAr bits of the 4x4x4 sub-cells of a grid voxel; all set w/o mask
+	G4double getLArFraction(const Voxel& voxel);	//LAr part of the voxel volume (1 w/o occupancy mask)
+	std::string geometryKey(G4bool withGrid = true);	//hash of the scan grid & the volume tree; caches are rebuilt if it differs
+
+	G4int getCurrentPhotonsPerVoxel(){return (currentVoxel.nPhotons > 0) ? currentVoxel.nPhotons : (G4int)fNParticles;};
+	G4double getTargetRelError(){return targetRelError;};
+	G4int getQmcReplicates(){return useQmc ? qmcReplicates : 0;};	//0: pseudo random
+	G4int getPhotonsInEvent(G4int eventInVoxel);	//eventInVoxel counted over batches (w/ event offset)
+	G4double getMaxPhotons(){return (maxPhotons > 0) ? maxPhotons : 100*fNParticles;};
+	void setEventOffset(G4int offset){eventOffset = offset;};	//events of the voxel already run (batches); keeps seeds unique
+	//nr of events (BeamOn) for the photons of one voxel; last event may hold less than photonsPerEvent
+	G4int getEventsPerVoxel(){return (getCurrentPhotonsPerVoxel() + photonsPerEvent - 1)/photonsPerEvent;};
+
+	//single BeamOn mode: all voxels in one run; event i belongs to voxel i/eventsPerVoxel
+	G4int collectVoxels();		//runs through nextVoxel() & stores all voxels; returns nr of voxels
+	void clearVoxelList();		//back to one run per voxel
+	size_t getVoxelListSize(){return voxelList.size();};
+	Voxel getVoxel(size_t i){return voxelList.at(i);};
+	G4bool isVoxelAborted(size_t i){return voxelListAborted.at(i);};
+
+	//adjoint mode (/scan/adjoint): photons start on the fiber shroud walls instead of in the voxels; RunList tallies
+	//their 128 nm track length per grid voxel (gridIndexAt). N = 0 switches back to the voxel scan
+	void setAdjointPhotons(G4int N){adjointPhotons = (N > 0) ? N : 0;};
+	G4int getAdjointPhotons(){return adjointPhotons;};
+	G4int getAdjointEvents(){return (adjointPhotons + photonsPerEvent - 1)/photonsPerEvent;};
+	G4int gridIndexAt(const G4ThreeVector& p);	//flat index of the grid voxel holding p (folded into the wedge on
+												//the polar grid); -1 if outside the grid. Valid after 1st nextVoxel
+	G4double getMinGridWidth(){return polarGrid ? std::min(gridWid[0], gridWid[2]) : std::min(gridWid[0], std::min(gridWid[1], gridWid[2]));};
+	//WLSR response table (RunList, /scan/wlsrTable): 450 nm photons isotropic from the shell segment r, z, phi in
+	//[min, max) (uniform in volume), weight 1. N = 0 switches it off
+	void setPatchSource(const G4double* rzPhi, G4int N);
+	G4int getPatchEvents(){return (patchPhotons + photonsPerEvent - 1)/photonsPerEvent;};
+	G4int getSymmetryImages(){return polarGrid ? (G4int)std::floor(2*M_PI/scanAngle + 0.5) : 1;};	//copies of the wedge folded by gridIndexAt
 
   private:
+	void syncFromMaster();	//MT: copies voxel & settings of the master instance (called per event on workers)
+	G4bool IsInArgonNavigator(const G4ThreeVector& rpos);
+	void lookupDetector();		//sets fDetector (once)
+	void updateScanAngle();		//scanAngle from the constructed geometry
+	void seedEvent(G4int eventInVoxel);	//reseeds engine from (seedBase, voxel index, event in voxel)
+	void GenerateAdjointVertex(G4Event *event);	//photons of the adjoint source (see setAdjointPhotons)
+	void GeneratePatchVertex(G4Event *event);	//photons of the patch source (see setPatchSource)
+
+	//randomized QMC: event e of a voxel belongs to replicate e % qmcReplicates; the photons of a replicate are
+	//consecutive points of a 5D Sobol sequence (u, v, w, cos theta, phi), digitally shifted per (voxel, replicate)
+	void qmcSample(G4int eventInVoxel, G4int iPhoton, G4double* x);
+	int nextPoint();	//nextVoxel for a point file: records in file order, flat index = record index
+	Voxel gridVoxel(uint32_t flatIndex, G4int xBins, G4int yBins, G4double xMin, G4double yMin, G4double zMin);
+
+	//occupancy mask: IsInArgon probed on 3x3x3 points in each of the 4x4x4 sub-cells per grid voxel, before any run.
+	//A sub-cell is LAr if any of its probes is, larFraction is the LAr share of all probes. nextVoxel skips voxels
+	//w/o LAr, PositionDecider samples the others uniformly in the LAr of their LAr sub-cells (IsInArgon decides).
+	//LAr thinner than the probe spacing (1/12 of the voxel) can still be missed
+	static const G4int occupancySub = 4;	//sub-cells per axis; occupancySub^3 bits have to fit into a uint64_t
+	static const G4int occupancyProbes = 3;	//probes per axis & sub-cell
+	void buildOccupancyMask(G4int xBins, G4int yBins, G4double xMin, G4double yMin, G4double zMin);
+	uint64_t sampleOccupancy(const Voxel& voxel, G4double* larFraction = NULL);
+	G4bool readOccupancyCache(const std::string& key);
+	void writeOccupancyCache(const std::string& key);
+	G4bool isMaskedOut(uint32_t flatIndex);
+
     static const G4double LambdaE;
     G4ParticleGun*	fParticleGun;
 	G4int verbosity;
@@ -75,8 +202,27 @@ class L200ParticleGenerator
     G4double fZ = 0;
     G4double fBinWidth = 0;
 	G4double scanAngle;		//defines y borders as from 0 to at least x*tan(scanAngle)
+							//half the Ge string pitch of the L200 geometry, 2 pi for other geometries
+	G4bool polarGrid = false;	//r/phi/z voxels in the wedge instead of the cartesian grid & skip loop
+	G4double fRadialWidth = 0;
+	G4double fPhiWidth = 0;		//rounded to an integer nr of bins in scanAngle
+	G4double fZWidth = 0;
+	G4double gridWid[3];		//pitch per axis of the current grid (set in nextVoxel)
+	G4double gridMin[3];		//lower edge & nr of bins per axis of the current grid (gridIndexAt)
+	G4int gridBins[3];
+	G4int adjointPhotons = 0;
+	G4double patch[6];			//rMin, rMax, zMin, zMax, phiMin, phiMax of the patch source
+	G4int patchPhotons = 0;
 
-    G4double fNParticles = 1;
+    G4double fNParticles = 1;		//photons per voxel
+    G4int photonsPerEvent = 1;		//independent primaries per G4Event (saves event overhead)
+    G4double targetRelError = 0;	//> 0: RunList repeats a voxel in batches of fNParticles until reached
+    G4double maxPhotons = 0;		//cap for the above; <= 0: 100*fNParticles
+    G4int eventOffset = 0;
+    G4bool useQmc = false;
+    G4int qmcReplicates = 8;	//independent shifts; spread of their estimates gives the qmcError column
+    G4double importanceFraction = 0;	//part of the photons sampled towards the shrouds (rest isotropic); 0: off
+    G4bool importanceWarned = false;
     G4ThreeVector fCenterVector;
     G4String fParticleType = "opticalphoton";
     G4double fEnergy = 0;
@@ -85,13 +231,40 @@ class L200ParticleGenerator
 	G4bool abortOnNonlar;		//if a single non-LAr hit should abort the whole voxel
 
     L200ParticleGeneratorMessenger* fMessenger;
+	L200ParticleGenerator* fMaster;	//NULL for the instance steered by RunList
 
 	Voxel currentVoxel;
 	G4bool larFailed;		//set in PositionDecider when no proper LAr position found
-	G4bool abortVoxel;		//set in Generate... @ hit of nonLar, read in Generate... & from RunList,
-							//reset in nextVoxel
+	std::atomic<G4bool> abortVoxel;		//set in Generate... @ hit of nonLar, read in Generate... & from RunList,
+							//reset in nextVoxel. In MT only the master's flag is used (set from all workers)
 
 	uint32_t flatVoxelIndex;	//flat index for current voxel (defines both x and y index if needed)
+	uint32_t validVoxelCount;	//nr of non-skipped voxels seen so far (round robin for shards)
+	uint32_t gridSize;
+	G4int shardIndex;
+	G4int shardCount;
+	long seedBase;		//drawn from the engine at the 1st voxel --> same for all shards w/ the same seed
+
+	G4int argonClassifier = analyticClassifier;
+	const L200DetectorConstruction* fDetector = NULL;	//NULL: not a L200 geometry (GDML, ...)
+	G4bool detectorLookedUp = false;
+	G4Navigator* fNavigator = NULL;		//own instance per generator (thread); the tracking one is left alone
+	G4int classifierMismatches = 0;
+
+	//point file: mapped read-only (zero copy), pages are loaded by the kernel on access
+	const PointRecord* pointRecords = NULL;
+	size_t pointFileBytes = 0;
+	uint32_t nPointRecords = 0;
+	void closePointFile();
+
+	G4bool useOccupancyMask = false;
+	G4String occupancyCache;		//"": no cache file
+	std::vector<uint64_t> occupancyMask;	//per flat index of the regular grid; empty until 1st nextVoxel
+	std::vector<G4double> occupancyFraction;	//LAr share per flat index (probes), same layout
+	uint64_t currentOccupancy = ~(uint64_t)0;	//mask of currentVoxel
+
+	std::vector<Voxel> voxelList;	//single BeamOn mode only (empty otherwise); in MT only the master's list is filled
+	std::vector<std::atomic<G4bool> > voxelListAborted;	//abortVoxel per voxel of voxelList
 
 };
 #endif
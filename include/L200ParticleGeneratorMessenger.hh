@@ -38,6 +38,21 @@ private:
   G4UIcmdWithAnInteger* fLiquidArgonSetD;
   G4UIcmdWithAnInteger* fSetVerboseCmd;
   G4UIcmdWithABool* fAbortNonlarCmd;
+  G4UIcommand* fShardCmd;
+  G4UIcmdWithAnInteger* fPhotonsPerEventCmd;
+  G4UIcmdWithADouble* fTargetRelErrorCmd;
+  G4UIcmdWithADouble* fMaxPhotonsCmd;
+  G4UIcmdWithABool* fQmcCmd;
+  G4UIcmdWithAnInteger* fQmcReplicatesCmd;
+  G4UIcmdWithADouble* fImportanceSamplingCmd;
+  G4UIcmdWithABool* fOccupancyMaskCmd;
+  G4UIcmdWithAString* fOccupancyCacheCmd;
+  G4UIcmdWithAString* fArgonClassifierCmd;
+  G4UIcmdWithAString* fGridCmd;
+  G4UIcmdWithAString* fPointFileCmd;
+  G4UIcmdWithADoubleAndUnit* fRadialWidthCmd;
+  G4UIcmdWithADoubleAndUnit* fPhiWidthCmd;
+  G4UIcmdWithADoubleAndUnit* fZWidthCmd;
 
 };
 #endif
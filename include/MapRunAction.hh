@@ -4,31 +4,103 @@
 #include "globals.hh"
 #include "G4UserRunAction.hh"
 
+#include <vector>
+#include <map>
+
 class G4Timer;
 class G4Run;
+class WlsrResponseTable;
 
 class MapRunAction : public G4UserRunAction
 {
   public:
-    MapRunAction(size_t nrOfVolumeIndices);//nrOfVolumeIndices not needed as vector gets resized on demand
+    MapRunAction(size_t nrOfVolumeIndices, MapRunAction* master = NULL);//nrOfVolumeIndices not needed as vector gets resized on demand
+								//master != NULL: worker thread action (MT), merges its counts into master @ EndOfRunAction
     virtual ~MapRunAction();
 
   public:
     virtual void BeginOfRunAction(const G4Run* aRun);
     virtual void EndOfRunAction(const G4Run* aRun);
 
-	void increment(G4int volID);	//increments one hit for a specific volume ID
+	void increment(G4int volID, G4double weight = 1., G4int primary = -1, G4bool countHit = true);	//increments one hit for a specific volume ID
 							//volID convention: >0; (0 not allowed, since that means no ID given). 
 							//also < 0 not allowed
+							//weight: statistical weight of the photon (/generator/importanceSampling)
+							//primary: track ID of the primary photon the hit descends from; hits of
+							//one primary (splitting) go into sumW2 as the square of their sum. -1: own primary
+							//countHit false: weight only (expected detections, e.g. from the WLSR table), no count
 
 	G4int getCount(G4int volID){return hitCount.at(volID-1);};
+	void addExpected(G4int volID, G4double value);	//next-event estimate (expected detections) for a volume ID
+	G4double getExpectedSum(G4int volID){return (volID-1 < (G4int)expectedSum.size()) ? expectedSum[volID-1] : 0;};
 	G4int getVolumeNr() {return hitCount.size();};
+	G4double getWeightSum(G4int volID){return (volID-1 < (G4int)weightSum.size()) ? weightSum[volID-1] : 0;};	//sum of hit weights
+	G4double getWeightSum2(G4int volID){return (volID-1 < (G4int)weightSum2.size()) ? weightSum2[volID-1] : 0;};	//sum of squared weights per primary
+
+	//single BeamOn mode (RunList): one row of counters per voxel, row = eventID/eventsPerVoxel
+	//nrOfVoxels = 0 switches back to total counts only
+	void setVoxelTable(size_t nrOfVoxels, G4int eventsPerVoxel);
+	G4int getCount(size_t voxel, G4int volID);		//0 if volume never hit in that voxel
+
+	//randomized QMC (one run per voxel): hit weights per replicate, replicate = (eventID + eventOffset) % nrOfReplicates
+	//nrOfReplicates = 0 switches them off
+	void setReplicates(G4int nrOfReplicates, G4int eventOffset);
+	G4double getReplicateWeight(G4int replicate, G4int volID);	//= counts w/o importance sampling
+
+	//adjoint mode (/scan/adjoint): weight x 128 nm track length per grid voxel; the values of one primary go
+	//into adjointSum2 as the square of their sum. nrOfVoxels = 0 switches it off
+	void setAdjointTable(size_t nrOfVoxels);
+	void addTrackLength(G4int voxel, G4double value, G4int primary);
+	G4double getAdjointSum(size_t voxel){return adjointSum.at(voxel);};
+	G4double getAdjointSum2(size_t voxel){return adjointSum2.at(voxel);};
+	G4int getAdjointHits(size_t voxel){return adjointHits.at(voxel);};	//nr of primaries that crossed the voxel
+
+	//two-stage transport (/scan/wlsrTable): set on the master between runs, workers read the master's. NULL: off
+	void setWlsrTable(const WlsrResponseTable* table){wlsrTable = table;};
+	const WlsrResponseTable* getWlsrTable(){return (master != NULL) ? master->wlsrTable : wlsrTable;};
+
+	//per photon records (/write/detections): LAr path lengths & reflections of every detected photon, for reweighting
+	//to other absorption lengths & reflectivities (g4simple-reweight). Set on the master, workers hand theirs over @ EndOfRunAction
+	static const G4int nrBounceCounters = 6;	//Cu, Tetratex, Ge (as L200DetectorConstruction::GetReflectivities) x 128 nm, 450 nm
+	struct Detection{
+		G4int eventID;
+		G4int primary;
+		G4double weight;
+		G4double lVUV;		//path in LAr at 128 nm
+		G4double lVis;		//at 450 nm (TPB light)
+		G4int bounces[nrBounceCounters];	//reflections; index 2*surface + (450 nm ? 1 : 0)
+	};
+	void setRecordDetections(G4bool flag){recordDetections = flag;};
+	G4bool isRecordingDetections(){return (master != NULL) ? master->recordDetections : recordDetections;};
+	void addDetection(G4double weight, G4int primary, G4double lVUV, G4double lVis, const G4int* bounces);
+	const std::vector<Detection>& getDetections();	//of the last run, sorted by event ID
 
   private:
+	void merge(const MapRunAction& worker);	//adds worker counts; caller holds the merge mutex
+	void flushPrimaryWeights();	//squares of the per primary sums of the current event --> weightSum2 (& adjointSum2)
+
+	MapRunAction* master;	//NULL for sequential mode & for the master thread
+
     //G4Timer* fTimer;
 	std::vector<G4int> hitCount;	//hit count per volume ((volID-1) = index in vector)
 									//I use this since I think its a bit faster than using a map.
 									//however, we should know the size of the vector beforehand.
+	std::vector<std::vector<G4int> > voxelHitCount;	//[voxel][volID-1]; empty if not in single BeamOn mode
+	G4int eventsPerVoxel;
+	std::vector<G4double> weightSum;	//same indexing as hitCount
+	std::vector<G4double> weightSum2;
+	std::vector<G4double> expectedSum;	//same indexing as hitCount
+	std::map<std::pair<G4int, G4int>, G4double> primaryWeight;	//(volID-1, primary) -> weight of the current event
+	G4int primaryWeightEvent;
+	std::vector<std::vector<G4double> > replicateWeight;	//[replicate][volID-1]; empty w/o QMC
+	G4int replicateOffset;
+	std::vector<G4double> adjointSum;	//[flat voxel index]; empty w/o adjoint mode
+	std::vector<G4double> adjointSum2;
+	std::vector<G4int> adjointHits;
+	std::map<std::pair<G4int, G4int>, G4double> adjointEvent;	//(voxel, primary) -> track length of the current event
+	const WlsrResponseTable* wlsrTable;
+	G4bool recordDetections;
+	std::vector<Detection> detections;
 };
 
 
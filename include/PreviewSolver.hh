@@ -0,0 +1,49 @@
+#ifndef PreviewSolver_h
+#define PreviewSolver_h
+/*
+Deterministic approximate map (g4simple --preview): no Monte Carlo, only the dimensions & optical parameters of
+L200DetectorConstruction. A 128 nm photon emitted at p is followed along a fixed grid of directions:
+ - fiber shroud walls crossed on the way detect it w/ fiberDetProb x fiberAtt x exp(-length/lArAbsLength)
+   (the rest passes on, as in the stepping action)
+ - reaching the WLSR it gives WLSMEANNUMBERPHOTONS TPB photons, (1 + R_Tetratex)/2 of them leave into the LAr
+   (Lambertian). Their detection probability per ring of the WLSR comes from a radiosity system over the rings:
+   direct light to the shrouds (visAbsLength) + diffuse reflection on TPB/Tetratex back to the other rings
+The geometry is rotationally symmetric for this (Ge strings, Cu, cryostat & Rayleigh scattering are left out), so
+the response of the WLSR only depends on z.
+*/
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+
+class L200DetectorConstruction;
+
+class PreviewSolver{
+public:
+	PreviewSolver(L200DetectorConstruction* detector, G4int nRings, G4int nDirections);
+
+	void prepare();		//WLSR response w/ the current optics (again after every sweep point)
+	G4double detectionProbability(const G4ThreeVector& p) const;	//of a 128 nm photon emitted isotropically at p
+
+private:
+	L200DetectorConstruction* detector;
+	G4int nRings;			//z bins of the WLSR
+	G4int nDirections;		//quadrature cells per angle (cos theta & phi)
+
+	G4bool hasWLSR;			//false: black WLSR (shrouds only)
+	G4double wlsrR;			//LAr side of the TPB layer
+	G4double wlsrZMin;
+	G4double wlsrZMax;
+	G4double emitted;		//TPB photons into the LAr per absorbed VUV photon
+	G4double absVUV;
+	G4double absVis;
+	G4double detProb;
+	std::vector<G4double> response;	//detection probability of a TPB photon leaving ring i
+
+	//straight ray from p along dir w/ attenuation length absLength: detected part on the shrouds, and (if it gets
+	//there through the shrouds) ring of the WLSR it ends on & remaining intensity. ring -1: lost
+	G4double traceRay(const G4ThreeVector& p, const G4ThreeVector& dir, G4double absLength, G4int& ring, G4double& remaining) const;
+};
+
+#endif
@@ -9,14 +9,21 @@ Commanded directly from main (after user inputs); is its own messenger.
 
 #include "MapRunAction.hh"
 #include "L200ParticleGenerator.hh"
+#include "WlsrResponseTable.hh"
 #include "G4RunManager.hh"
 #include "G4Run.hh"
 #include "G4UIdirectory.hh"
 #include "G4UIcmdWithAString.hh"
 #include "G4UIcmdWithABool.hh"
 #include "G4UIcmdWithADouble.hh"
+#include "G4UIcmdWithAnInteger.hh"
+
+#include <fstream>
+#include <vector>
+#include <string>
 
 class G4VAnalysisManager;
+class L200DetectorConstruction;
 
 class RunList : public G4UImessenger{
 public:
@@ -27,6 +34,8 @@ public:
 	virtual void SetNewValue(G4UIcommand *cmd, G4String newValue);	//@override G4UImessenger
 
 	void startRuns();	//starts all runs until all voxels in the generator are run through
+	void setWorkerProcesses(G4int n){workerProcesses = n;};	//> 0: fork that many workers per sweep point (sequential build only)
+	void setPreview(G4bool flag){preview = flag;};	//g4simple --preview: deterministic map (PreviewSolver), no BeamOn
 
 private:
 	L200ParticleGenerator* generator;
@@ -34,18 +43,130 @@ private:
 	
 	G4UIdirectory* writeDir;
   	G4UIcmdWithAString* writeFilename;
+	G4UIcmdWithABool* detectionsCmd;
+	G4UIdirectory* scanDir;
+	G4UIcmdWithABool* singleBeamOnCmd;
+	G4UIcommand* adaptiveCmd;
+	G4UIcommand* checkpointCmd;
+	G4UIcmdWithAString* resumeCmd;
+	G4UIcmdWithAnInteger* adjointCmd;
+	G4UIcommand* wlsrTableCmd;
+	G4UIcommand* previewCmd;
+	G4UIdirectory* sweepDir;
+	G4UIcmdWithAString* sweepAbsVUVCmd;
+	G4UIcmdWithAString* sweepAbsVisCmd;
+	G4UIcmdWithAString* sweepFiberCmd;
+	G4UIcmdWithAString* sweepRayCmd;
 
 	G4String filename;
+	G4bool writeDetections;	//detections ntuple: weight & LAr path lengths of every detected photon
+	void fillDetections(G4int voxelIndex, G4int eventOffset);	//of the last run (single BeamOn: voxelIndex -1, from the event ID)
+	G4bool singleBeamOn;	//all voxels in one BeamOn (voxel from event ID) instead of one run per voxel
 
 	void openFile();
 	void clearVars();
-	void writeRun(G4int nrPrimaries);	//writes single run to file using the ana manager
+	//outcome of one voxel; POD (also lives in the shared memory of the worker pool)
+	struct VoxelResult{
+		G4int counts;
+		G4int photons;
+		G4int aborted;
+		G4double qmcError;		//-1 w/o QMC replicates
+		G4double sumW;			//sum & sum of squares of the hit weights (= counts w/o importance sampling)
+		G4double sumW2;
+		G4double nee;			//next-event estimate of the detections; 0 w/ the estimator off, -1 w/o per voxel runs (singleBeamOn, adjoint, preview)
+	};
+	void runVoxel(G4RunManager* rm, G4int nrPrimaries);	//runs & writes the current voxel
+	VoxelResult simulateVoxel(G4RunManager* rm, G4int nrPrimaries);	//batches of nrPrimaries photons
+
+	//adaptive scan: run the regular grid, then repeatedly halve (along the scanned axes) every voxel whose
+	//detection probability differs by more than adaptiveThreshold from a face neighbour of the same size
+	struct ScanCell{
+		L200ParticleGenerator::Voxel voxel;
+		VoxelResult result;
+	};
+	G4double adaptiveThreshold;		//<= 0: off
+	G4double adaptiveMinWidth;		//voxels are not split below this width
+	void runAdaptive(G4RunManager* rm);	//replaces the nextVoxel loop for one sweep point
+
+	//worker pool (g4simple --workers N): the parent builds the physics tables, forks N workers sharing them
+	//copy-on-write; workers pull voxels from an atomic counter in shared memory and put counts next to it.
+	//The parent writes all rows in voxel order (same output as a single process: voxels seed themselves)
+	struct PoolResult{
+		VoxelResult result;
+		G4int done;
+	};
+	G4int workerProcesses;
+	void runWorkerPool(G4RunManager* rm);	//replaces the nextVoxel loop for one sweep point
+	void writeVoxel(const L200ParticleGenerator::Voxel& voxel, const VoxelResult& result);	//writes one row (aborted: 0 counts)
+	void startSingleRun(G4RunManager* rm);	//singleBeamOn version of startRuns
+
+	//adjoint mode: one run of adjointPhotons photons from the fiber shrouds (traced w/ the reciprocal optics) gives
+	//the whole map; detection probability of a voxel = sum of weight x 128 nm track length / (4 pi V_LAr N)
+	G4int adjointPhotons;		//0: forward scan
+	void runAdjoint(G4RunManager* rm);	//replaces the nextVoxel loop for one sweep point
+	void fillRow();		//fills the row members below into the ntuple
+
+	//two-stage transport: detection probability of a TPB emission per WLSR patch, built once (or read from
+	//wlsrCache) per set of optics; 128 nm photons reaching the TPB are then scored from the table & killed
+	G4int wlsrPhotons;		//photons per patch; 0: off
+	G4int wlsrZBins;
+	G4int wlsrPhiBins;
+	G4String wlsrCache;		//empty: no cache
+	WlsrResponseTable wlsrTable;
+	std::string wlsrKey;	//what the current table was built for
+	void prepareWlsrTable(G4RunManager* rm);	//for the current sweep point
+
+	//preview: approximate map from view factors & a radiosity system over the WLSR (see PreviewSolver)
+	G4bool preview;
+	G4int previewRings;			//z bins of the WLSR
+	G4int previewDirections;	//quadrature cells per angle
+	void runPreview();		//replaces the nextVoxel loop for one sweep point
+
+	//optical sweeps: the whole scan is repeated for every point of the cartesian product of all lists
+	//(empty list: value of the macro); index = ((iVUV*nVis + iVis)*nFiber + iFiber)*nRay + iRay
+	std::vector<G4double> sweepAbsVUV;
+	std::vector<G4double> sweepAbsVis;
+	std::vector<G4double> sweepFiber;
+	std::vector<G4bool> sweepRay;
+	G4int sweepIndex;		//current sweep point (also written per row)
+	L200DetectorConstruction* detector;	//NULL if not the L200 geometry (then only fiberDetProb can be swept)
+	G4double baseAbsVUV, baseAbsVis, baseFiber;	//values from the macro
+	G4bool baseRay;
+
+	G4int nrSweepPoints();
+	void sweepPoint(G4int index, G4double& absVUV, G4double& absVis, G4double& fiber, G4bool& ray);
+	void applySweepPoint(G4int index);	//sets optical parameters; physics tables only rebuilt if Rayleigh changes
+	void writeSweepRow(G4int index);
+
+	//checkpointing: <checkpointName>.rows gets every row written (text), <checkpointName> the state
+	//(generator cursor, engine, nr of valid rows); the state file is replaced atomically (rename)
+	G4String checkpointName;
+	G4int checkpointEvery;		//voxels btw. 2 checkpoints
+	G4int voxelsSinceCheckpoint;
+	G4int rowsWritten;
+	std::ofstream checkpointRows;
+	G4String resumeName;		//checkpoint to continue from (empty: fresh start)
+
+	void openCheckpoint(const std::vector<std::string>& keptRows);
+	void writeCheckpoint();
+	std::vector<std::string> resume();		//restores cursor & engine, re-fills the rows of the checkpoint (returned as text)
+	void dumpRow(std::ostream& os);
+	G4bool readRow(std::istream& is);
 
 	G4int count;
 	G4int initialNr;		//initial nr of photons
 	G4double voxelX;		//voxel middle point
 	G4double voxelY;
 	G4double voxelZ;
+	G4int voxelIndex;		//flat voxel index (sort key for g4simple-merge)
+	G4double voxelXWid;		//voxel size (varies w/ /scan/adaptive)
+	G4double voxelYWid;
+	G4double voxelZWid;
+	G4double larFraction;	//LAr volume fraction (occupancy mask)
+	G4double qmcError;		//standard error of counts/initialNr from the QMC replicates; -1 if n/a
+	G4double sumW;			//sum of hit weights; sumW/initialNr is the detection probability
+	G4double sumW2;			//sum of squared hit weights (variance of the above)
+	G4double nee;			//expected direct detections from the OpWLS re-emissions (/optics/nextEventEstimator)
 
 	G4VAnalysisManager* analysis;		//for writing out counts
 };
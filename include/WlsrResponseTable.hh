@@ -0,0 +1,39 @@
+#ifndef WlsrResponseTable_h
+#define WlsrResponseTable_h
+/*
+Detection probability of a 450 nm photon emitted isotropically in the TPB of the WLSR, per patch of the
+WLSR cylinder (z & phi within the symmetry wedge). Built by RunList w/ the normal optics (/scan/wlsrTable),
+looked up by the stepping action for every 128 nm photon entering the TPB (two-stage transport).
+*/
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+#include <vector>
+#include <string>
+
+class WlsrResponseTable{
+public:
+	WlsrResponseTable();
+
+	void setLayout(G4int nZ, G4int nPhi, G4double zMin, G4double zMax, G4double wedge);	//clears the values
+	G4int size() const {return nZ*nPhi;};
+	void getPatch(G4int index, G4double& zLow, G4double& zHigh, G4double& phiLow, G4double& phiHigh) const;
+	void setValue(G4int index, G4double value){values.at(index) = value;};
+	G4double lookup(const G4ThreeVector& p) const;	//p folded into the wedge; 0 outside the z range
+
+	//cache: text file w/ one or more tables, each starting w/ "g4simple-wlsr 1 <key> <layout>"
+	//key: one token standing for everything the values depend on (geometry, optics, photons per patch)
+	G4bool read(const G4String& file, const std::string& key);	//false if there is no table w/ that key
+	void write(const G4String& file, const std::string& key) const;	//appended to the file
+
+private:
+	G4int nZ;
+	G4int nPhi;
+	G4double zMin;
+	G4double zMax;
+	G4double wedge;		//2 pi: no symmetry
+	std::vector<G4double> values;	//index = iZ*nPhi + iPhi
+};
+
+#endif
@@ -36,12 +36,16 @@ TH2D* getSegment(const char* file){
 
 	double xPos, yPos, zPos;
 	int counts, initialNr;
+	double sumW = -1;
 
 	map->SetBranchAddress("xPos", &xPos);
 	map->SetBranchAddress("yPos", &yPos);
 	map->SetBranchAddress("zPos", &zPos);
 	map->SetBranchAddress("counts", &counts);
 	map->SetBranchAddress("initialNr", &initialNr);
+	//sumW/initialNr: detection probability also for weighted modes (counts is then biased); older files: counts
+	bool hasSumW = (map->GetBranch("sumW") != NULL);
+	if(hasSumW) map->SetBranchAddress("sumW", &sumW);
 
 	double xMin = 1e50, xMax = -1e50, yMin = 1e50, yMax = -1e50;
 	double xPitch = 1e50, yPitch = 1e50;
@@ -78,15 +82,28 @@ TH2D* getSegment(const char* file){
 	for(int i = 0; i < entries; i++){
 		map->GetEntry(i);
 
-		histo->SetBinContent(histo->FindBin(xPos,yPos),((double)counts)/initialNr);
+		histo->SetBinContent(histo->FindBin(xPos,yPos),(hasSumW ? sumW : (double)counts)/initialNr);
 	}
 
 
 	return histo;
 }
 
-TH2D* getRotSymPlot(const char* file, double cuts=14 ){
+//nr of string (= rotation) copies from the symmetry wedge in the file's meta tree; 14 for files w/o it
+double getCuts(const char* file){
+	TFile theFile(file);
+	TTree* meta = (TTree*) theFile.Get("meta");
+	double symmetryAngle = 0;
+	if(meta == NULL || meta->GetEntries() == 0) return 14;
+	meta->SetBranchAddress("symmetryAngle", &symmetryAngle);
+	meta->GetEntry(0);
+	return (int)(TMath::Pi()/symmetryAngle+0.5);	//wedge is half a string pitch; 2 pi (no symmetry) --> 1
+}
+
+TH2D* getRotSymPlot(const char* file, double cuts=-1 ){	//cuts <= 0: from the file
 
+	if(cuts <= 0) cuts = getCuts(file);
+	if(cuts < 1) cuts = 1;
 	TH2D* cakepiece = NULL;
 	cakepiece = getSegment(file);
 
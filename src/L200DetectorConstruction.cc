@@ -40,6 +40,7 @@
 #include "G4Transform3D.hh"
 
 #include <cmath>
+#include <algorithm>
 using namespace CLHEP;
 
 // = = = = = = = = = = = KONSTRUKTOR & DESTRUKTOR = = = = = = = = = = = = = =
@@ -57,6 +58,7 @@ L200DetectorConstruction::L200DetectorConstruction()
 	wslrCopperPhys		= NULL;
 	wslrTetraTexPhys	= NULL;
 	wslrTPBPhys		= NULL;
+	geDisc_log		= NULL;
 
 	world_mat 		= NULL;
 	lAr_mat 		= NULL;
@@ -67,6 +69,7 @@ L200DetectorConstruction::L200DetectorConstruction()
 	TPB_mat			= NULL;
 	enrGe_mat = NULL;
 	black_mat = NULL;
+	lArMPT = NULL;
 
 	wlsrBlack = false;
 
@@ -212,6 +215,7 @@ void L200DetectorConstruction::InitializeMaterials(){
 	mptLAr->AddProperty("ABSLENGTH",photonEnergy,lArAbsorption,NUM);
 
 	lAr_mat->SetMaterialPropertiesTable(mptLAr);
+	lArMPT = mptLAr;
 
  	//Copper
 	copper_mat = nist->FindOrBuildMaterial("G4_Cu");
@@ -300,6 +304,26 @@ void L200DetectorConstruction::InitializeMaterials(){
 }
 
 
+void L200DetectorConstruction::UpdateLArOptics(){
+	if(lArMPT == NULL) return;	//not yet built: InitializeMaterials takes the new values anyway
+
+	//same tables as in InitializeMaterials
+	const G4int NUM = 2;
+	G4double photonEnergy[NUM] = {lambdaE/(lArWL),lambdaE/(tpbWL)};
+	G4double lArAbsorption[NUM] = {lArAbsVUV,lArAbsVis};
+	G4double temperature = lAr_mat->GetTemperature();
+	G4double lArRayLength[NUM]={LArRayLength(lArWL,temperature),LArRayLength(tpbWL,temperature)};
+
+	lArMPT->RemoveProperty("ABSLENGTH");
+	lArMPT->AddProperty("ABSLENGTH",photonEnergy,lArAbsorption,NUM);
+	lArMPT->RemoveProperty("RAYLEIGH");
+	if(lArRay)
+		lArMPT->AddProperty("RAYLEIGH",photonEnergy,lArRayLength,NUM);
+	//ABSLENGTH is read by G4OpAbsorption on every step; RAYLEIGH goes into a physics table
+	// --> caller has to issue /run/physicsModified if lArRay changed
+}
+
+
 // = = = = = = = = = = = = = = = CONSTRUCT = = = = = = = = = = = = = =
 
 G4VPhysicalVolume* L200DetectorConstruction::Construct(){
@@ -461,6 +485,10 @@ void L200DetectorConstruction::FillLAr(){
         	coord_z[i] += generalPolyconeZShift;
     	}
 
+	G4int firstPlane = (hneck==0) ? 1 : 0;	//same planes as the polycone below
+	lArPlaneZ.assign(coord_z+firstPlane, coord_z+numzplanes);
+	lArPlaneR.assign(coord_rOuter+firstPlane, coord_rOuter+numzplanes);
+
    	G4Polycone* thePolycone;
    	G4String theCryoPartName ="larVolume";
 
@@ -624,6 +652,196 @@ void L200DetectorConstruction::BuildGeDetectors(){
 }
 
 
+//everything is placed w/o rotation around the z axis --> only r, phi & z needed
+G4bool L200DetectorConstruction::IsInLAr(const G4ThreeVector& p) const{
+	G4double z = p.z();
+	if(lArPlaneZ.empty() || z > lArPlaneZ.front() || z < lArPlaneZ.back()) return false;
+	G4double r = p.perp();
+	for(size_t k = 0; k+1 < lArPlaneZ.size(); k++){
+		if(z < lArPlaneZ[k+1]) continue;
+		G4double dz = lArPlaneZ[k+1] - lArPlaneZ[k];
+		G4double rMax = (dz == 0) ? std::max(lArPlaneR[k], lArPlaneR[k+1])
+			: lArPlaneR[k] + (lArPlaneR[k+1]-lArPlaneR[k])*(z-lArPlaneZ[k])/dz;
+		if(r > rMax) return false;		//cryostat wall or outside
+		break;
+	}
+
+	//fiber shrouds (own volumes, even if LAr material)
+	if(std::abs(z-innerShroudZOffset) <= innerShroudHeight/2. && r >= innerShroudInnerR && r <= innerShroudOuterR) return false;
+	if(std::abs(z-outerShroudZOffset) <= outerShroudHeight/2. && r >= outerShroudInnerR && r <= outerShroudOuterR) return false;
+
+	//WLSR: copper, tetratex & TPB (the latter two not for black WLSR)
+	G4double wlsrInnerR = wlsrBlack ? wslrCopperInnerR : wslrTetraTexInnerR-wslrTPBThickness;
+	if(std::abs(z) <= wslrHeight/2. && r >= wlsrInnerR && r <= wslrCopperOuterR) return false;
+
+	//Ge discs: the string nearest in phi is also the nearest one in the xy plane
+	if(geStringCount > 0 && geDetectorsInString > 0){
+		G4double stringFullHeight = geDetectorsInString*geDiscHeight+(geDetectorsInString-1)*geDiscGap;
+		G4double zString = z + stringFullHeight/2.;		//0 @ bottom of lowest disc
+		if(zString >= 0 && zString <= stringFullHeight){
+			G4double stringAngle = 2.*M_PI/geStringCount;
+			G4double phi = std::floor(p.phi()/stringAngle + 0.5)*stringAngle;
+			G4double dx = p.x() - geArrayRad*std::cos(phi);
+			G4double dy = p.y() - geArrayRad*std::sin(phi);
+			if(dx*dx + dy*dy <= geDiscRad*geDiscRad){
+				G4double pitch = geDiscHeight + geDiscGap;
+				if(zString - std::floor(zString/pitch)*pitch <= geDiscHeight) return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+//cos of the polar angle to a point dz above & h away in the xy plane
+static G4double cosTo(G4double dz, G4double h){
+	return (dz == 0) ? 0 : dz/std::sqrt(dz*dz + h*h);
+}
+
+void L200DetectorConstruction::GetShroudAngularBox(const G4ThreeVector& p, G4double& cosMin, G4double& cosMax, G4double& phiMin, G4double& phiWidth) const{
+	//every point of a shroud (solid tube up to outerR) lies btw. r-outerR and r+outerR away in the xy plane
+	G4double r = p.perp();
+	const G4double outerR[2] = {innerShroudOuterR, outerShroudOuterR};
+	const G4double zOffset[2] = {innerShroudZOffset, outerShroudZOffset};
+	const G4double height[2] = {innerShroudHeight, outerShroudHeight};
+	cosMin = 1;
+	cosMax = -1;
+	for(int i = 0; i < 2; i++){
+		G4double hMin = std::max(0., r-outerR[i]);
+		G4double hMax = r+outerR[i];
+		G4double dzTop = zOffset[i] + height[i]/2. - p.z();
+		G4double dzBottom = zOffset[i] - height[i]/2. - p.z();
+		cosMax = std::max(cosMax, cosTo(dzTop, (dzTop >= 0) ? hMin : hMax));
+		cosMin = std::min(cosMin, cosTo(dzBottom, (dzBottom <= 0) ? hMin : hMax));
+	}
+
+	//the outer shroud covers the phi range of the inner one (same axis)
+	G4double rMax = std::max(outerR[0], outerR[1]);
+	if(r <= rMax){
+		phiMin = 0;
+		phiWidth = 2.*M_PI;
+		return;
+	}
+	G4double halfWidth = std::asin(rMax/r);
+	phiMin = std::atan2(-p.y(), -p.x()) - halfWidth;
+	phiWidth = 2.*halfWidth;
+}
+
+
+const G4VPhysicalVolume* L200DetectorConstruction::HitShroud(const G4ThreeVector& p, const G4ThreeVector& dir, G4double& length, G4double& zFromBottom, G4double& halfHeight) const{
+	const G4double innerR[2] = {innerShroudInnerR, outerShroudInnerR};
+	const G4double outerR[2] = {innerShroudOuterR, outerShroudOuterR};
+	const G4double zOffset[2] = {innerShroudZOffset, outerShroudZOffset};
+	const G4double height[2] = {innerShroudHeight, outerShroudHeight};
+	const G4VPhysicalVolume* phys[2] = {fiberShroudInnerPhys, fiberShroudOuterPhys};
+	const G4double tolerance = 1e-6*mm;
+
+	//a*t^2 + 2*b*t + c = 0 for the cylinder walls
+	G4double a = dir.x()*dir.x() + dir.y()*dir.y();
+	G4double b = p.x()*dir.x() + p.y()*dir.y();
+	const G4VPhysicalVolume* hit = NULL;
+	length = DBL_MAX;
+	for(int i = 0; i < 2; i++){
+		if(phys[i] == NULL) continue;
+		G4double zMin = zOffset[i] - height[i]/2.;
+		G4double zMax = zOffset[i] + height[i]/2.;
+		G4double t[6];
+		int n = 0;
+		const G4double R[2] = {innerR[i], outerR[i]};
+		for(int k = 0; k < 2 && a > 0; k++){
+			G4double disc = b*b - a*(p.perp2() - R[k]*R[k]);
+			if(disc < 0) continue;
+			t[n++] = (-b - std::sqrt(disc))/a;
+			t[n++] = (-b + std::sqrt(disc))/a;
+		}
+		if(dir.z() != 0){
+			t[n++] = (zMin - p.z())/dir.z();
+			t[n++] = (zMax - p.z())/dir.z();
+		}
+		//nearest candidate that is on the surface of the tube
+		for(int k = 0; k < n; k++){
+			if(t[k] <= 0 || t[k] >= length) continue;
+			G4ThreeVector q = p + t[k]*dir;
+			G4double r = q.perp();
+			if(q.z() < zMin-tolerance || q.z() > zMax+tolerance || r < innerR[i]-tolerance || r > outerR[i]+tolerance) continue;
+			length = t[k];
+			zFromBottom = q.z() - zMin;
+			halfHeight = height[i]/2.;
+			hit = phys[i];
+		}
+	}
+	return hit;
+}
+
+
+G4double L200DetectorConstruction::SampleShroudSurface(G4ThreeVector& p, G4ThreeVector& normal, G4double& zFromBottom, G4double& halfHeight) const{
+	const G4double radius[4] = {innerShroudInnerR, innerShroudOuterR, outerShroudInnerR, outerShroudOuterR};
+	const G4double side[4] = {-1., 1., -1., 1.};		//inner walls face the axis
+	const G4double zOffset[4] = {innerShroudZOffset, innerShroudZOffset, outerShroudZOffset, outerShroudZOffset};
+	const G4double height[4] = {innerShroudHeight, innerShroudHeight, outerShroudHeight, outerShroudHeight};
+	G4double area[4];
+	G4double total = 0;
+	for(int i = 0; i < 4; i++){
+		area[i] = 2.*M_PI*radius[i]*height[i];
+		total += area[i];
+	}
+
+	G4double pick = G4UniformRand()*total;
+	int i = 0;
+	while(i < 3 && pick > area[i]){
+		pick -= area[i];
+		i++;
+	}
+	G4double phi = 2.*M_PI*G4UniformRand();
+	zFromBottom = height[i]*G4UniformRand();
+	halfHeight = height[i]/2.;
+	normal.set(side[i]*std::cos(phi), side[i]*std::sin(phi), 0.);
+	p.set(radius[i]*std::cos(phi), radius[i]*std::sin(phi), zOffset[i] - halfHeight + zFromBottom);
+	return total;
+}
+
+
+G4bool L200DetectorConstruction::GetWLSRTPB(G4double& innerR, G4double& outerR, G4double& zCenter, G4double& halfHeight) const{
+	if(wlsrBlack || wslrTPBPhys == NULL) return false;
+	innerR = wslrTetraTexInnerR - wslrTPBThickness;
+	outerR = wslrTetraTexInnerR;
+	zCenter = wslrTPBPhys->GetTranslation().z();
+	halfHeight = wslrHeight/2.;
+	return true;
+}
+
+
+//REFLECTIVITY of the optical skin surface of a volume; NULL if there is none
+static G4MaterialPropertyVector* skinReflectivity(const G4LogicalVolume* volume){
+	G4LogicalSkinSurface* skin = (volume != NULL) ? G4LogicalSkinSurface::GetSurface(volume) : NULL;
+	G4OpticalSurface* surface = (skin != NULL) ? dynamic_cast<G4OpticalSurface*>(skin->GetSurfaceProperty()) : NULL;
+	G4MaterialPropertiesTable* mpt = (surface != NULL) ? surface->GetMaterialPropertiesTable() : NULL;
+	return (mpt != NULL) ? mpt->GetProperty("REFLECTIVITY") : NULL;
+}
+
+
+G4bool L200DetectorConstruction::GetWLSROptics(G4double& tpbYield, G4double& reflectivity) const{
+	if(wlsrBlack || wslrTPBPhys == NULL || wslrTetraTexPhys == NULL) return false;
+	G4MaterialPropertiesTable* tpbMPT = wslrTPBPhys->GetLogicalVolume()->GetMaterial()->GetMaterialPropertiesTable();
+	G4MaterialPropertyVector* tetraReflectivity = skinReflectivity(wslrTetraTexPhys->GetLogicalVolume());
+	if(tpbMPT == NULL || !tpbMPT->ConstPropertyExists("WLSMEANNUMBERPHOTONS") || tetraReflectivity == NULL) return false;
+	tpbYield = tpbMPT->GetConstProperty("WLSMEANNUMBERPHOTONS");
+	reflectivity = tetraReflectivity->Value(lambdaE/tpbWL);
+	return true;
+}
+
+
+void L200DetectorConstruction::GetReflectivities(G4double vis[3], G4double vuv[3]) const{
+	const G4LogicalVolume* volumes[3] = {(wslrCopperPhys != NULL) ? wslrCopperPhys->GetLogicalVolume() : NULL,
+		(wslrTetraTexPhys != NULL) ? wslrTetraTexPhys->GetLogicalVolume() : NULL, geDisc_log};
+	for(int i = 0; i < 3; i++){
+		G4MaterialPropertyVector* reflectivity = skinReflectivity(volumes[i]);
+		vis[i] = (reflectivity != NULL) ? reflectivity->Value(lambdaE/tpbWL) : -1;
+		vuv[i] = (reflectivity != NULL) ? reflectivity->Value(lambdaE/lArWL) : -1;
+	}
+}
+
+
 void L200DetectorConstruction::UpdateGeometry()
 {
 	G4cout << "Geometry updated" << G4endl;
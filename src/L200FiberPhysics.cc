@@ -2,11 +2,11 @@
 #include "G4ProcessManager.hh"
 #include "G4SystemOfUnits.hh"
 
+G4ThreadLocal L200OpBoundaryProcess* L200FiberPhysics::fL200OpBoundaryProcess = NULL;
+
 L200FiberPhysics::L200FiberPhysics(G4int verbose, const G4String& name) : G4VPhysicsConstructor(name) {
 
-	fL200OpBoundaryProcess = NULL;
 	verboseLevel = verbose;
-	theProb = 0.4;
 	theTPBMagicMaterialName="LiquidArgonFiber";
 	theLArWL = 128*nm;
 }
@@ -14,6 +14,7 @@ L200FiberPhysics::L200FiberPhysics(G4int verbose, const G4String& name) : G4VPhy
 L200FiberPhysics::~L200FiberPhysics(){
 
 	delete fL200OpBoundaryProcess;
+	fL200OpBoundaryProcess = NULL;
 }
 
 void L200FiberPhysics::ConstructParticle() {
@@ -25,7 +26,6 @@ void L200FiberPhysics::ConstructProcess() {
 
 	fL200OpBoundaryProcess = new L200OpBoundaryProcess();
 
-	fL200OpBoundaryProcess->setFiberHitProb(theProb);
 	fL200OpBoundaryProcess->setMagicMaterialName(theTPBMagicMaterialName);
 	fL200OpBoundaryProcess->setLArWL(theLArWL);
 
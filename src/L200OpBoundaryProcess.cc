@@ -5,6 +5,7 @@
 
 #include "L200OpBoundaryProcess.hh"
 #include "G4GeometryTolerance.hh"
+#include "G4ProcessManager.hh"
 
 // Class Implementation
 
@@ -54,13 +55,35 @@ L200OpBoundaryProcess::L200OpBoundaryProcess(const G4String& processName,
         thePhotonMomentum = 0.;
         Rindex1 = Rindex2 = cost1 = cost2 = sint1 = sint2 = 0.;
 
-	theProb = 0;
 	theTPBMagicMaterialName = "LiquidArgonFiber";
 	theLArWL= 128*nm;
 
 
 }
 
+G4double L200OpBoundaryProcess::theProb = 0;
+G4double L200OpBoundaryProcess::theWeightFloor = 0;
+
+void L200OpBoundaryProcess::applyWeightFloor()
+{
+	G4ProcessManager* manager = G4OpticalPhoton::OpticalPhotonDefinition()->GetProcessManager();
+	G4VProcess* absorption = (manager != NULL) ? manager->GetProcess("OpAbsorption") : NULL;
+	if(absorption != NULL && manager->GetProcessActivation(absorption) != (theWeightFloor <= 0)){
+		manager->SetProcessActivation(absorption, theWeightFloor <= 0);	//before the first step: no analog absorption
+	}
+}
+
+G4double L200OpBoundaryProcess::fiberIntensity(G4double x)
+{
+	const G4double I1 = 0.042; //trapped in core prob
+	const G4double I2 = 0.068; //trapped in core + first cladding prob
+	const G4double I3 = 0.209; //trapped in core + first cladding + second cladding prob
+	const G4double attL =3900*mm;
+	const G4double attS =225*mm;
+
+	return I2*exp(-x/attL) + (I3 - I2)*exp(-x/attS);
+}
+
 // L200OpBoundaryProcess::L200OpBoundaryProcess(const L200OpBoundaryProcess &right)
 // {
 // }
@@ -78,6 +101,7 @@ G4VParticleChange*
 L200OpBoundaryProcess::PostStepDoIt(const G4Track& aTrack, const G4Step& aStep)
 {
         theStatus = Undefined;
+        theWeightFactor = 1.;
 
         aParticleChange.Initialize(aTrack);
 
@@ -399,7 +423,7 @@ L200OpBoundaryProcess::PostStepDoIt(const G4Track& aTrack, const G4Step& aStep)
 		     DielectricDielectric();
 		  }
 		  else {
-		     if ( !G4BooleanRand(theReflectivity) ) {
+		     if ( SurfaceAbsorbs() ) {
 			DoAbsorption();
 		     }
 		     else {
@@ -442,6 +466,9 @@ L200OpBoundaryProcess::PostStepDoIt(const G4Track& aTrack, const G4Step& aStep)
 		   aParticleChange.ProposeVelocity(finalVelocity);
 		}
 
+		if ( theWeightFactor != 1. )
+		   aParticleChange.ProposeWeight(aTrack.GetWeight()*theWeightFactor);
+
 		return G4VDiscreteProcess::PostStepDoIt(aTrack, aStep);
 	}
 	//TPB Trick
@@ -653,7 +680,9 @@ void L200OpBoundaryProcess::DielectricMetal()
 
            n++;
 
-           if( !G4BooleanRand(theReflectivity) && n == 1 ) {
+           //rolled also for n > 1 (result unused) as before: same random sequence w/o implicit capture
+           G4bool absorbed = (n == 1) ? SurfaceAbsorbs() : !G4BooleanRand(theReflectivity);
+           if( absorbed && n == 1 ) {
 
              // Comment out DoAbsorption and uncomment theStatus = Absorption;
              // if you wish to have Transmission instead of Absorption
@@ -668,7 +697,7 @@ void L200OpBoundaryProcess::DielectricMetal()
              if (PropertyPointer1 && PropertyPointer2) {
                 if ( n > 1 ) {
                    CalculateReflectivity();
-                   if ( !G4BooleanRand(theReflectivity) ) {
+                   if ( SurfaceAbsorbs() ) {
                       DoAbsorption();
                       break;
                    }
@@ -1007,7 +1036,7 @@ void L200OpBoundaryProcess::DielectricDielectric()
           if( theFinish == polishedbackpainted ||
               theFinish == groundbackpainted ) {
 
-              if( !G4BooleanRand(theReflectivity) ) {
+              if( SurfaceAbsorbs() ) {
                 DoAbsorption();
               }
               else {
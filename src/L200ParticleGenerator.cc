@@ -2,6 +2,7 @@
 
 #include "G4ios.hh"
 #include "G4Event.hh"
+#include "G4PrimaryVertex.hh"
 #include "G4Gamma.hh"
 #include "G4Electron.hh"
 #include "G4Alpha.hh"
@@ -19,15 +20,32 @@
 #include "L200ParticleGeneratorMessenger.hh"
 #include "G4TransportationManager.hh"
 #include "G4Navigator.hh"
+#include "G4Exception.hh"
+#include "G4RunManager.hh"
+#include "L200DetectorConstruction.hh"
+#include "L200OpBoundaryProcess.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <bitset>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace CLHEP;
 
 const G4double L200ParticleGenerator::LambdaE = twopi *1.973269602e-16 * m * GeV;
 
-L200ParticleGenerator::L200ParticleGenerator()
-	: scanAngle(2*M_PI/28), flatVoxelIndex(0), verbosity(0), abortVoxel(false), abortOnNonlar(true)
+L200ParticleGenerator::L200ParticleGenerator(L200ParticleGenerator* master)
+	: scanAngle(2*M_PI/28), flatVoxelIndex(0), validVoxelCount(0), gridSize(0), shardIndex(0), shardCount(1), seedBase(0),
+	  verbosity(0), abortVoxel(false), abortOnNonlar(true), fMaster(master)
 {
-	fMessenger = new L200ParticleGeneratorMessenger(this);
+	//worker copies are steered via their master; only the master gets the /generator/ commands
+	fMessenger = (master == NULL) ? new L200ParticleGeneratorMessenger(this) : NULL;
 	fParticleGun = new G4ParticleGun(1);
 	fLArWL = 128*nm;
 	fCurrentEnergy = LambdaE/fLArWL;
@@ -38,12 +56,20 @@ L200ParticleGenerator::~L200ParticleGenerator()
 {
   delete fMessenger;
   delete fParticleGun;
+  delete fNavigator;
+  closePointFile();
 }
 
 
 int L200ParticleGenerator::nextVoxel(){
 
 	abortVoxel = false;
+	if(flatVoxelIndex == 0){	//(re)start of scan
+		validVoxelCount = 0;
+		seedBase = (long)(G4UniformRand()*2147483647.);
+	}
+	if(pointRecords != NULL) return nextPoint();
+	updateScanAngle();
 
 	//#### Part I: make voxel pattern over 1st quadrant ###
 	G4double xMax = fRadiusMax;
@@ -81,44 +107,66 @@ int L200ParticleGenerator::nextVoxel(){
 		break;
 	}
 
+	if(!polarGrid && yBins > 1 && scanAngle > M_PI/2){	//wedge leaves the 1st quadrant: grid over the whole circle
+		xMin = -fRadiusMax;
+		xBins = (xMax-xMin)/fBinWidth;
+		yMin = -fRadiusMax;
+		yBins = (yMax-yMin)/fBinWidth;
+	}
+
+	gridWid[0] = gridWid[1] = gridWid[2] = fBinWidth;
+	if(polarGrid){
+		//x -> r (from fRadiusMin), y -> phi over the symmetry wedge only, z as above
+		//no skipping needed: every voxel is in the wedge
+		gridWid[0] = (fRadialWidth > 0) ? fRadialWidth : fBinWidth;
+		gridWid[2] = (fZWidth > 0) ? fZWidth : fBinWidth;
+		xMin = fRadiusMin;
+		xBins = (fRadiusMax-fRadiusMin)/gridWid[0];
+		yMin = 0;
+		yBins = 1;
+		if((fDim == 2 || fDim == 3) && fPhiWidth > 0) yBins = std::max(1, (G4int)std::floor(scanAngle/fPhiWidth + 0.5));	//integer nr of bins in the wedge
+		gridWid[1] = scanAngle/yBins;
+		if(fDim == 3 || fDim == 4) zBins = (zMax-zMin)/gridWid[2];
+		if(flatVoxelIndex == 0 && (fCenterVector.getX() != 0 || fCenterVector.getY() != 0)){
+			G4Exception("L200ParticleGenerator::nextVoxel","polarCenter",JustWarning,
+				"polar grid is around the z axis; x & y of SetCenterVector are ignored");
+		}
+	}
+
   if(flatVoxelIndex == 0 && verbosity >= 1){
     G4cout<<"N bins XY "<<xBins*yBins<<" x/y Max "<<xMax/cm<<"(cm), x/y Min "<<fRadiusMin/cm<<"(cm), Z "<<fZ<<"(cm), binWidth "<<fBinWidth/cm<<"(cm)..."<< fNParticles<<" particles per voxel, with "<<fNParticles*xBins*yBins<<" photons generated"<<G4endl;
   }
 
 	//### Part II: define dimensions of current voxel; skipping if exceeds angle ###
+	gridSize = xBins*yBins*zBins;
+	gridMin[0] = xMin;
+	gridMin[1] = yMin;
+	gridMin[2] = zMin;
+	gridBins[0] = xBins;
+	gridBins[1] = yBins;
+	gridBins[2] = zBins;
+	if(useOccupancyMask && occupancyMask.size() != gridSize) buildOccupancyMask(xBins, yBins, xMin, yMin, zMin);
 	while(true){	//loop should not affect 1D case (break always after 1st call)
-		if(flatVoxelIndex == xBins*yBins*zBins) return 0;		//escape condition
-
-		//decide indices
-		int iBinZ = flatVoxelIndex / (xBins*yBins);		//int division @ wörk
-		int iBinY = (flatVoxelIndex-iBinZ*xBins*yBins)/xBins;
-		int iBinX = flatVoxelIndex-iBinZ*xBins*yBins - iBinY*xBins;
+		if(flatVoxelIndex == gridSize) return 0;		//escape condition
 
-		//decide positions
-		  G4double x = xMin + iBinX*fBinWidth;
-		  G4double y = yMin + iBinY*fBinWidth;
-		  G4double z = zMin + iBinZ*fBinWidth;
-		  //G4cout<<"Generating point randomly ("<<x<<","<<y<<","<<fZ<<")"<<G4endl;
-
-		currentVoxel.xPos = x + fCenterVector.getX();
-		currentVoxel.yPos = y + fCenterVector.getY();
-		currentVoxel.zPos = z + fCenterVector.getZ();
-
-		currentVoxel.xWid = fBinWidth;
-		currentVoxel.yWid = fBinWidth;
-		currentVoxel.zWid = fBinWidth;
+		currentVoxel = gridVoxel(flatVoxelIndex, xBins, yBins, xMin, yMin, zMin);
 
 		//escape skip loop in case bottom right point of voxel within angle
-		// and bottom left point is still within radius
-		if(currentVoxel.yPos <= tan(scanAngle)*(abs(currentVoxel.xPos)+currentVoxel.xWid) &&
-			currentVoxel.xPos*currentVoxel.xPos+currentVoxel.yPos*currentVoxel.yPos <= fRadiusMax*fRadiusMax) break;
-
-		if(verbosity >= 3) G4cout << "Skipping voxel "<<currentVoxel<<" for symmetry reasons" << G4endl;
+		// and bottom left point is still within radius (and voxel belongs to this shard)
+		if(isInScanRegion(currentVoxel)){
+			if(isMaskedOut(flatVoxelIndex)){	//before the shard count: same mask in all shards anyway
+				if(verbosity >= 3) G4cout << "Skipping voxel "<<currentVoxel<<" (occupancy mask: non-LAr)" << G4endl;
+			}
+			else if(validVoxelCount++ % shardCount == shardIndex) break;
+			else if(verbosity >= 3) G4cout << "Skipping voxel "<<currentVoxel<<" (other shard)" << G4endl;
+		}
+		else if(verbosity >= 3) G4cout << "Skipping voxel "<<currentVoxel<<" for symmetry reasons" << G4endl;
 
 		flatVoxelIndex++;	//increment if volume skipped
 	}
 
 	if(verbosity >= 3) G4cout << "Will use voxel "<<currentVoxel<<" in the following." << G4endl;
+	currentOccupancy = getOccupancy(flatVoxelIndex);
 
 	//### Part III: increment index for next call & report particle count ###
 	flatVoxelIndex++;	//increment after --> 1st voxel is 0
@@ -126,6 +174,346 @@ int L200ParticleGenerator::nextVoxel(){
 }
 
 
+int L200ParticleGenerator::nextPoint(){
+	gridSize = nPointRecords;
+	while(true){
+		if(flatVoxelIndex >= gridSize) return 0;
+		if(validVoxelCount++ % shardCount == shardIndex) break;
+		flatVoxelIndex++;	//other shard
+	}
+
+	const PointRecord& record = pointRecords[flatVoxelIndex];
+	currentVoxel = Voxel();
+	currentVoxel.xPos = record.x;
+	currentVoxel.yPos = record.y;
+	currentVoxel.zPos = record.z;
+	currentVoxel.xWid = currentVoxel.yWid = currentVoxel.zWid = 0;
+	currentVoxel.index = flatVoxelIndex;
+	currentVoxel.nPhotons = record.nPhotons;
+	currentOccupancy = ~(uint64_t)0;
+	if(verbosity >= 3) G4cout << "Will use point "<<flatVoxelIndex<<" "<<currentVoxel<<" in the following." << G4endl;
+
+	flatVoxelIndex++;
+	return getCurrentPhotonsPerVoxel();
+}
+
+
+void L200ParticleGenerator::SetPointFile(G4String path){
+	closePointFile();
+	if(path == "") return;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat info;
+	if(fd < 0 || fstat(fd, &info) != 0){
+		if(fd >= 0) close(fd);
+		G4Exception("L200ParticleGenerator::SetPointFile","noPointFile",FatalErrorInArgument,("cannot open "+path).c_str());
+		return;
+	}
+	size_t bytes = info.st_size;
+	if(bytes == 0 || bytes % sizeof(PointRecord) != 0 || bytes/sizeof(PointRecord) > 2147483647){
+		close(fd);
+		G4Exception("L200ParticleGenerator::SetPointFile","badPointFile",FatalErrorInArgument,
+			(path+": size is not a multiple of the 32 byte record (x, y, z double; nPhotons, reserved uint32)").c_str());
+		return;
+	}
+	void* data = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	//the mapping stays valid
+	if(data == MAP_FAILED){
+		G4Exception("L200ParticleGenerator::SetPointFile","badPointFile",FatalErrorInArgument,("cannot map "+path).c_str());
+		return;
+	}
+	madvise(data, bytes, MADV_SEQUENTIAL);
+	pointRecords = static_cast<const PointRecord*>(data);
+	pointFileBytes = bytes;
+	nPointRecords = bytes/sizeof(PointRecord);
+	flatVoxelIndex = 0;
+	if(verbosity >= 1) G4cout << "Point file "<<path<<": "<<nPointRecords<<" points"<<G4endl;
+}
+
+
+void L200ParticleGenerator::closePointFile(){
+	if(pointRecords != NULL) munmap(const_cast<PointRecord*>(pointRecords), pointFileBytes);
+	pointRecords = NULL;
+	pointFileBytes = 0;
+	nPointRecords = 0;
+}
+
+
+
+
+
+
+
+
+
+
+
+L200ParticleGenerator::Voxel L200ParticleGenerator::gridVoxel(uint32_t flatIndex, G4int xBins, G4int yBins,
+		G4double xMin, G4double yMin, G4double zMin){
+	//decide indices
+	int iBinZ = flatIndex / (xBins*yBins);		//int division @ wörk
+	int iBinY = (flatIndex-iBinZ*xBins*yBins)/xBins;
+	int iBinX = flatIndex-iBinZ*xBins*yBins - iBinY*xBins;
+
+	//decide positions
+	Voxel voxel;
+	voxel.polar = polarGrid;
+	voxel.xPos = xMin + iBinX*gridWid[0] + (polarGrid ? 0 : fCenterVector.getX());
+	voxel.yPos = yMin + iBinY*gridWid[1] + (polarGrid ? 0 : fCenterVector.getY());
+	voxel.zPos = zMin + iBinZ*gridWid[2] + fCenterVector.getZ();
+
+	voxel.xWid = gridWid[0];
+	voxel.yWid = gridWid[1];
+	voxel.zWid = gridWid[2];
+	voxel.index = flatIndex;
+	return voxel;
+}
+
+
+void L200ParticleGenerator::buildOccupancyMask(G4int xBins, G4int yBins, G4double xMin, G4double yMin, G4double zMin){
+	std::string key = geometryKey();
+	if(occupancyCache != "" && readOccupancyCache(key)){
+		if(verbosity >= 1) G4cout << "Occupancy mask read from "<<occupancyCache<<G4endl;
+		return;
+	}
+
+	occupancyMask.assign(gridSize, 0);
+	occupancyFraction.assign(gridSize, 0);
+	uint32_t partly = 0, empty = 0;
+	for(uint32_t i = 0; i < gridSize; i++){
+		Voxel voxel = gridVoxel(i, xBins, yBins, xMin, yMin, zMin);
+		if(!isInScanRegion(voxel)) continue;	//never visited
+		uint64_t mask = sampleOccupancy(voxel, &occupancyFraction[i]);
+		occupancyMask[i] = mask;
+		if(mask == 0) empty++;
+		else if(mask != ~(uint64_t)0) partly++;
+	}
+	if(verbosity >= 1) G4cout << "Occupancy mask: "<<empty<<" voxels w/o LAr, "<<partly<<" partly non-LAr"<<G4endl;
+	if(occupancyCache != "") writeOccupancyCache(key);
+}
+
+
+uint64_t L200ParticleGenerator::sampleOccupancy(const Voxel& voxel, G4double* larFraction){
+	const G4int n = occupancySub*occupancyProbes;	//probes per axis of the voxel
+	uint64_t mask = 0;
+	G4int inside = 0;
+	for(G4int bit = 0; bit < occupancySub*occupancySub*occupancySub; bit++){
+		G4int iu = bit % occupancySub;
+		G4int iv = (bit / occupancySub) % occupancySub;
+		G4int iw = bit / (occupancySub*occupancySub);
+		G4int hits = 0;
+		for(G4int p = 0; p < occupancyProbes*occupancyProbes*occupancyProbes; p++){
+			G4int pu = iu*occupancyProbes + p % occupancyProbes;
+			G4int pv = iv*occupancyProbes + (p / occupancyProbes) % occupancyProbes;
+			G4int pw = iw*occupancyProbes + p / (occupancyProbes*occupancyProbes);
+			if(IsInArgon(voxel.pointAt((pu+0.5)/n, (pv+0.5)/n, (pw+0.5)/n))) hits++;
+		}
+		if(hits > 0) mask |= (uint64_t)1 << bit;
+		inside += hits;
+	}
+	if(larFraction != NULL) *larFraction = inside/(G4double)(n*n*n);
+	return mask;
+}
+
+
+std::string L200ParticleGenerator::geometryKey(G4bool withGrid){
+	//everything the mask depends on: grid (incl. symmetry wedge) and position/shape/material of all volumes
+	std::ostringstream os;
+	os << std::setprecision(17);
+	if(withGrid){
+		os << gridSize <<" "<< fDim <<" "<< fBinWidth <<" "<< fRadiusMax <<" "<< fZ
+			<<" "<< fCenterVector <<" "<< scanAngle <<" "<< polarGrid <<" "<< gridWid[0] <<" "<< gridWid[1] <<" "<< gridWid[2] << "\n";
+	}
+	G4PhysicalVolumeStore* store = G4PhysicalVolumeStore::GetInstance();
+	for(size_t i = 0; i < store->size(); i++){
+		G4VPhysicalVolume* pv = store->at(i);
+		G4LogicalVolume* lv = pv->GetLogicalVolume();
+		os << pv->GetName() <<" "<< pv->GetCopyNo() <<" "<< pv->GetObjectTranslation() <<" "<< pv->GetObjectRotationValue()
+			<<" "<< lv->GetName() <<" "<< lv->GetMaterial()->GetName() << "\n";
+		lv->GetSolid()->StreamInfo(os);
+	}
+
+	//FNV-1a
+	std::string text = os.str();
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < text.size(); i++){
+		hash ^= (unsigned char)text[i];
+		hash *= 0x100000001b3ULL;
+	}
+	std::ostringstream key;
+	key << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return key.str();
+}
+
+
+G4bool L200ParticleGenerator::readOccupancyCache(const std::string& key){
+	std::ifstream in(occupancyCache.c_str());
+	std::string magic, fileKey;
+	G4int version = 0;
+	uint32_t size = 0;
+	if(!(in >> magic >> version >> fileKey >> size)) return false;
+	if(magic != "g4simple-occupancy" || version != 2 || fileKey != key || size != gridSize){
+		if(verbosity >= 1) G4cout << "Occupancy cache "<<occupancyCache<<" is for another geometry/grid; rebuilding"<<G4endl;
+		return false;
+	}
+	std::vector<uint64_t> mask(size);
+	std::vector<G4double> fraction(size);
+	for(uint32_t i = 0; i < size; i++){
+		if(!(in >> std::hex >> mask[i] >> std::dec >> fraction[i])) return false;
+	}
+	occupancyMask.swap(mask);
+	occupancyFraction.swap(fraction);
+	return true;
+}
+
+
+void L200ParticleGenerator::writeOccupancyCache(const std::string& key){
+	std::string tmpName = occupancyCache + ".tmp";
+	std::ofstream out(tmpName.c_str());
+	out << "g4simple-occupancy 2\n" << key << "\n" << gridSize << "\n" << std::setprecision(17);
+	for(uint32_t i = 0; i < gridSize; i++) out << std::hex << occupancyMask[i] << " " << std::dec << occupancyFraction[i] << "\n";
+	out.close();
+	if(!out || std::rename(tmpName.c_str(), occupancyCache.c_str()) != 0){
+		G4Exception("L200ParticleGenerator::writeOccupancyCache","cacheWriteFailed",JustWarning,
+			("could not write occupancy cache "+occupancyCache).c_str());
+	}
+}
+
+
+G4int L200ParticleGenerator::gridIndexAt(const G4ThreeVector& p){
+	G4double u[3];
+	if(polarGrid){
+		//fold into the wedge [0, scanAngle]: wedges alternate mirrored around the circle
+		G4double phi = std::atan2(p.y(), p.x());
+		if(phi < 0) phi += 2*M_PI;
+		if(scanAngle < 2*M_PI - 1e-9){
+			phi = std::fmod(phi, 2*scanAngle);
+			if(phi > scanAngle) phi = 2*scanAngle - phi;
+		}
+		u[0] = p.perp();
+		u[1] = phi;
+		u[2] = p.z() - fCenterVector.getZ();
+	}
+	else{
+		u[0] = p.x() - fCenterVector.getX();
+		u[1] = p.y() - fCenterVector.getY();
+		u[2] = p.z() - fCenterVector.getZ();
+	}
+
+	G4int bin[3];
+	for(int a = 0; a < 3; a++){
+		G4double b = std::floor((u[a] - gridMin[a])/gridWid[a]);
+		if(b < 0 || b >= gridBins[a]) return -1;
+		bin[a] = (G4int)b;
+	}
+	return bin[0] + gridBins[0]*(bin[1] + gridBins[1]*bin[2]);
+}
+
+
+G4bool L200ParticleGenerator::isMaskedOut(uint32_t flatIndex){
+	if(!useOccupancyMask) return false;
+	return occupancyMask.at(flatIndex) == 0;	//partly non-LAr ones are sampled in their LAr sub-cells
+}
+
+
+uint64_t L200ParticleGenerator::getOccupancy(uint32_t index){
+	if(!useOccupancyMask || index >= occupancyMask.size()) return ~(uint64_t)0;	//no mask or refined voxel
+	return occupancyMask[index];
+}
+
+
+G4double L200ParticleGenerator::getLArFraction(const Voxel& voxel){
+	if(!useOccupancyMask) return 1.;
+	if(voxel.index < occupancyFraction.size()) return occupancyFraction[voxel.index];
+	G4double fraction;
+	sampleOccupancy(voxel, &fraction);	//refined voxel
+	return fraction;
+}
+
+
+G4bool L200ParticleGenerator::isInScanRegion(const Voxel& voxel){
+	if(voxel.polar) return true;	//polar grid only covers the wedge
+	//point of the voxel closest to the axis still within radius (bottom left one in the 1st quadrant)
+	G4double xNear = std::max(voxel.xPos, std::min(0., voxel.xPos+voxel.xWid));
+	G4double yNear = std::max(voxel.yPos, std::min(0., voxel.yPos+voxel.yWid));
+	if(xNear*xNear+yNear*yNear > fRadiusMax*fRadiusMax) return false;
+	if(scanAngle <= M_PI/2){
+		//bottom right point of voxel within angle
+		return voxel.yPos <= tan(scanAngle)*(abs(voxel.xPos)+voxel.xWid);
+	}
+	if(scanAngle >= 2*M_PI - 1e-9 || (xNear == 0 && yNear == 0)) return true;	//no symmetry or voxel on the axis
+	for(int c = 0; c < 4; c++){		//wide wedge: any corner inside
+		G4double phi = std::atan2(voxel.yPos + (c >> 1)*voxel.yWid, voxel.xPos + (c & 1)*voxel.xWid);
+		if(phi < 0) phi += 2*M_PI;
+		if(phi <= scanAngle) return true;
+	}
+	return false;
+}
+
+
+void L200ParticleGenerator::getScanAxes(G4bool& x, G4bool& y, G4bool& z){
+	//same cases as in nextVoxel
+	x = true;
+	y = (fDim != 1 && fDim != 4);
+	z = (fDim == 3 || fDim == 4);
+}
+
+
+void L200ParticleGenerator::setCurrentVoxel(const Voxel& voxel){
+	currentVoxel = voxel;
+	abortVoxel = false;
+	//refined voxels (/scan/adaptive) are not in the table: sampled here
+	if(useOccupancyMask && voxel.index >= occupancyMask.size()) currentOccupancy = sampleOccupancy(voxel);
+	else currentOccupancy = getOccupancy(voxel.index);
+}
+
+
+void L200ParticleGenerator::setShard(G4int index, G4int count){
+	if(count < 1 || index < 0 || index >= count){
+		G4Exception("L200ParticleGenerator::setShard","badShard",FatalErrorInArgument,
+			"need 0 <= index < count for /generator/shard");
+	}
+	shardIndex = index;
+	shardCount = count;
+}
+
+
+void L200ParticleGenerator::setCursor(uint32_t flatIndex, uint32_t validCount, long seed){
+	flatVoxelIndex = flatIndex;
+	validVoxelCount = validCount;
+	seedBase = seed;
+}
+
+
+G4int L200ParticleGenerator::collectVoxels(){
+	clearVoxelList();
+	std::vector<Voxel> voxels;
+	while(nextVoxel() != 0){
+		if(currentVoxel.nPhotons != 0){	//event -> voxel mapping needs the same nr of events everywhere
+			G4Exception("L200ParticleGenerator::collectVoxels","photonsPerPoint",FatalErrorInArgument,
+				"point file w/ nPhotons per record needs one run per voxel (no /scan/singleBeamOn)");
+		}
+		voxels.push_back(currentVoxel);
+	}
+
+	if(voxels.size()*(double)getEventsPerVoxel() > 2147483647.){	//BeamOn takes a G4int
+		G4Exception("L200ParticleGenerator::collectVoxels","tooManyEvents",FatalErrorInArgument,
+			"nr of voxels x events per voxel exceeds the max nr of events of one run; use one run per voxel or more /generator/photonsPerEvent");
+	}
+	std::vector<std::atomic<G4bool> >(voxels.size()).swap(voxelListAborted);
+	for(size_t i = 0; i < voxelListAborted.size(); i++) voxelListAborted[i] = false;
+	voxelList.swap(voxels);
+
+	if(verbosity >= 1) G4cout << "Collected "<<voxelList.size()<<" voxels for a single run"<<G4endl;
+	return voxelList.size();
+}
+
+
+void L200ParticleGenerator::clearVoxelList(){
+	voxelList.clear();
+	std::vector<std::atomic<G4bool> >().swap(voxelListAborted);
+	flatVoxelIndex = 0;	//rewind: nextVoxel() starts from the 1st voxel again
+}
 
 
 
@@ -135,10 +523,12 @@ int L200ParticleGenerator::nextVoxel(){
 
 
 
-void L200ParticleGenerator::DirectionDecider()
+
+void L200ParticleGenerator::DirectionDecider(const G4double* qmc)
 {
-  G4double phi = 2*pi*G4UniformRand();
-  G4double costheta = 2*G4UniformRand() -1;
+  //(cos theta, phi) uniform on the unit square is area preserving --> stratified on the sphere for QMC
+  G4double phi = 2*pi*((qmc != NULL) ? qmc[1] : G4UniformRand());
+  G4double costheta = 2*((qmc != NULL) ? qmc[0] : G4UniformRand()) -1;
   G4double theta = acos(costheta);
 
   G4double px = cos(phi)*sin(theta);
@@ -149,31 +539,114 @@ void L200ParticleGenerator::DirectionDecider()
 }
 
 
+G4double L200ParticleGenerator::BiasedDirectionDecider()
+{
+  //defensive mixture: importanceFraction uniform in the (cos theta, phi) box of the shrouds, rest isotropic,
+  //so every direction keeps a non-zero density & the weights stay bounded by 1/(1-importanceFraction)
+  lookupDetector();
+  if(fDetector == NULL){
+	if(!importanceWarned){
+		G4Exception("L200ParticleGenerator::BiasedDirectionDecider","noShroudsToBias",JustWarning,
+			"/generator/importanceSampling needs the L200 geometry; sampling isotropically");
+		importanceWarned = true;
+	}
+	DirectionDecider();
+	return 1.;
+  }
+  G4double cosMin, cosMax, phiMin, phiWidth;
+  fDetector->GetShroudAngularBox(fCurrentPosition, cosMin, cosMax, phiMin, phiWidth);
+  G4double boxSolidAngle = (cosMax - cosMin)*phiWidth;
+  if(boxSolidAngle <= 0){
+	DirectionDecider();
+	return 1.;
+  }
+
+  if(G4UniformRand() < importanceFraction){
+	G4double costheta = cosMin + (cosMax - cosMin)*G4UniformRand();
+	G4double phi = phiMin + phiWidth*G4UniformRand();
+	G4double sintheta = std::sqrt(std::max(0., 1. - costheta*costheta));
+	fDirection.set(cos(phi)*sintheta, sin(phi)*sintheta, costheta);
+  }
+  else DirectionDecider();
+
+  //weight = isotropic density / mixture density (the isotropic part can land inside the box as well)
+  G4double dphi = fDirection.phi() - phiMin;
+  dphi -= 2*pi*std::floor(dphi/(2*pi));
+  G4bool inBox = fDirection.cosTheta() >= cosMin && fDirection.cosTheta() <= cosMax && dphi <= phiWidth;
+  G4double density = (1. - importanceFraction)/(4*pi) + (inBox ? importanceFraction/boxSolidAngle : 0);
+  return 1./(4*pi*density);
+}
 
 
-void L200ParticleGenerator::PositionDecider(G4double xPos,G4double yPos,G4double zPos,G4double binWidth)
+
+
+G4ThreeVector L200ParticleGenerator::LambertianDirection(const G4ThreeVector& normal)
+{
+  //cos theta = sqrt(u): density cos theta / pi on the hemisphere
+  G4double cosTheta = std::sqrt(G4UniformRand());
+  G4double sinTheta = std::sqrt(1. - cosTheta*cosTheta);
+  G4double phi = 2*pi*G4UniformRand();
+  G4ThreeVector dir(sinTheta*cos(phi), sinTheta*sin(phi), cosTheta);
+  dir.rotateUz(normal);
+  return dir;
+}
+
+
+
+
+void L200ParticleGenerator::PositionDecider(const Voxel& voxel, uint64_t* occupancy, const G4double* qmc)
 {
 
   larFailed = false;
   G4ThreeVector rpos(1,1,1);
   G4bool isIn = false;
   int errorCounter = 0;
+  G4int nCells = (occupancy != NULL) ? std::bitset<64>(*occupancy).count() : 0;
+  G4int misses[64] = {0};		//per sub-cell
   while(!isIn){
-	//Random position in voxel
-  	G4double x = xPos,y=yPos,z=zPos;
-  	G4double rand = G4UniformRand();
-  	x += binWidth*rand;
-  	rand = G4UniformRand();
-  	y += binWidth*rand;
-  	rand = G4UniformRand();
-  	z += binWidth*rand;
-  	rpos.setX(x);rpos.setY(y);rpos.setZ(z);
+	if(occupancy != NULL && nCells == 0){	//no LAr found by the probes or in any sub-cell
+		rpos.setX(1000000);rpos.setY(1000000);rpos.setZ(1000000);
+		larFailed = true;
+		if(verbosity >= 1) G4cout << "No LAr sub-cell left in voxel "<<voxel<<G4endl;
+		break;
+	}
+	//Random position in voxel (x, y, z rolled in this order)
+  	G4double u = G4UniformRand();
+  	G4double v = G4UniformRand();
+  	G4double w = G4UniformRand();
+	if(qmc != NULL && errorCounter == 0){	//retries (boundary cut) are pseudo random
+		u = qmc[0];
+		v = qmc[1];
+		w = qmc[2];
+	}
+	G4int bit = -1;
+	if(nCells > 0){
+		//occupancy mask: uniform in the LAr sub-cells only (a miss picks a new one, so uniform in their LAr);
+		//u is reused for choosing the sub-cell
+		G4double pick = u*nCells;
+		G4int k = std::min((G4int)pick, nCells-1);
+		u = pick - k;
+		for(bit = 0; bit < 64; bit++){
+			if(((*occupancy >> bit) & 1) && k-- == 0) break;
+		}
+		u = (bit % occupancySub + u)/occupancySub;
+		v = ((bit / occupancySub) % occupancySub + v)/occupancySub;
+		w = (bit / (occupancySub*occupancySub) + w)/occupancySub;
+	}
+  	rpos = voxel.pointAt(u, v, w);
 
   	//Is it in the Argon?
   	//Note that in the Stepping Action, a step or two are taken before intial position is stored
   	isIn = IsInArgon(rpos);
   	errorCounter++;
-  	if((!isIn) && (errorCounter > 1e2 || abortOnNonlar)){
+	//w/ occupancy mask a miss is only a sub-cell cut by a boundary: retry; a sub-cell missed 100 times for one
+	//photon (hardly any LAr) is dropped for the rest of the event instead of aborting the voxel
+	if(!isIn && bit >= 0 && ++misses[bit] > 1e2){
+		*occupancy &= ~((uint64_t)1 << bit);
+		nCells--;
+		if(verbosity >= 2) G4cout << "Dropping sub-cell "<<bit<<" of voxel "<<voxel<<" (no LAr hit)"<<G4endl;
+	}
+  	if((!isIn) && occupancy == NULL && (errorCounter > 1e2 || abortOnNonlar)){
     	   rpos.setX(1000000);rpos.setY(1000000);rpos.setZ(1000000);
 	   // if error counter exceeds, we do not want to produce a photon hence the large values of co-ordinates
 			larFailed = true;
@@ -185,63 +658,296 @@ void L200ParticleGenerator::PositionDecider(G4double xPos,G4double yPos,G4double
   fCurrentPosition = rpos;
 
 }
+void L200ParticleGenerator::lookupDetector()
+{
+  if(detectorLookedUp) return;
+  //works for the master & worker run managers (workers share the master's construction)
+  fDetector = dynamic_cast<const L200DetectorConstruction*>(G4RunManager::GetRunManager()->GetUserDetectorConstruction());
+  detectorLookedUp = true;
+  if(fDetector == NULL && verbosity >= 1)
+	G4cout << "No L200 geometry: IsInArgon uses a navigator lookup, no symmetry wedge" << G4endl;
+}
+
+
+void L200ParticleGenerator::updateScanAngle()
+{
+  //strings are the only non-axial-symmetric part; wedge from a string axis to half way to the next one
+  lookupDetector();
+  G4int nStrings = (fDetector != NULL) ? fDetector->getNrGeStrings() : 0;
+  G4double angle = (nStrings > 0) ? M_PI/nStrings : 2*M_PI;
+  if(angle != scanAngle && verbosity >= 1) G4cout << "Symmetry wedge "<<angle/deg<<" deg"<<G4endl;
+  scanAngle = angle;
+}
+
+
 G4bool L200ParticleGenerator::IsInArgon(G4ThreeVector rpos)
 {
-  bool isit = false;
-  //This is how Geant4 suggests you should randomly generate a point in a volume
-  G4ThreeVector myPoint = rpos;
-  G4Navigator* theNavigator = G4TransportationManager::GetTransportationManager()->GetNavigatorForTracking();
-  G4VPhysicalVolume* myVolume = theNavigator->LocateGlobalPointAndSetup(myPoint);
-  if(myVolume->GetName() == "larVolume") isit = true;
-  //G4cout<< " The current material is " << myVolume->GetName() << " okay " <<G4endl;
+  lookupDetector();
+  if(fDetector == NULL || argonClassifier == navigatorClassifier) return IsInArgonNavigator(rpos);
+
+  G4bool isit = fDetector->IsInLAr(rpos);
+  if(argonClassifier == crosscheckClassifier){
+	G4bool nav = IsInArgonNavigator(rpos);
+	if(nav != isit){
+		if(classifierMismatches++ == 0){
+			G4Exception("L200ParticleGenerator::IsInArgon","classifierMismatch",JustWarning,
+				"analytic LAr classifier disagrees w/ navigator (geometry changed w/o IsInLAr?)");
+		}
+		if(verbosity >= 1) G4cout << "IsInArgon mismatch #"<<classifierMismatches<<" @ "<<rpos
+			<<": analytic "<<isit<<", navigator "<<nav<<G4endl;
+		isit = nav;		//trust the navigator
+	}
+  }
   return isit;
 }
 
 
-void L200ParticleGenerator::GeneratePrimaryVertex(G4Event *event)
+G4bool L200ParticleGenerator::IsInArgonNavigator(const G4ThreeVector& rpos)
 {
-	if(abortVoxel) return;		//dont mess around any more with a aborted voxel.
-
-    fParticleGun->SetParticlePolarization(G4ThreeVector(2*G4UniformRand()-1,2*G4UniformRand()-1,2*G4UniformRand()-1 ) );
-
-    //what is the particle
-    fParticleGun->SetParticleDefinition(G4OpticalPhoton::OpticalPhotonDefinition());
-    //determine particle momentum direction
-    DirectionDecider();
-
-    //determine particle position
-    PositionDecider(currentVoxel.xPos,
-		    currentVoxel.yPos,
-		    currentVoxel.zPos,
-		    fBinWidth);
-    //if(fCurrentPosition == G4ThreeVector(1000000,1000000,1000000))return;// break;
-	if(larFailed){		//fail bit arrived from position decider
-		if(abortOnNonlar){
-			abortVoxel = true;
-			if(verbosity >= 1) G4cout << "Aborting voxel "<<currentVoxel<<G4endl;
-		}
-		return;		//go out of primary production immediately
+  //This is how Geant4 suggests you should randomly generate a point in a volume
+  //(w/ an own navigator: the state of the tracking one is not touched)
+  G4VPhysicalVolume* world = G4TransportationManager::GetTransportationManager()->GetNavigatorForTracking()->GetWorldVolume();
+  if(fNavigator == NULL) fNavigator = new G4Navigator();
+  if(fNavigator->GetWorldVolume() != world) fNavigator->SetWorldVolume(world);	//also after a geometry rebuild
+  G4VPhysicalVolume* myVolume = fNavigator->LocateGlobalPointAndSetup(rpos, NULL, false, true);
+  return myVolume != NULL && myVolume->GetName() == "larVolume";
+}
+
+
+void L200ParticleGenerator::syncFromMaster(){
+	//only read here: master writes these between runs (nextVoxel / messenger), never during BeamOn
+	currentVoxel = fMaster->currentVoxel;
+	currentOccupancy = fMaster->currentOccupancy;
+	fBinWidth = fMaster->fBinWidth;
+	abortOnNonlar = fMaster->abortOnNonlar;
+	argonClassifier = fMaster->argonClassifier;
+	importanceFraction = fMaster->importanceFraction;
+	adjointPhotons = fMaster->adjointPhotons;
+	patchPhotons = fMaster->patchPhotons;
+	for(int i = 0; i < 6; i++) patch[i] = fMaster->patch[i];
+	photonsPerEvent = fMaster->photonsPerEvent;
+	//grid layout for gridIndexAt (stepping action of this thread)
+	polarGrid = fMaster->polarGrid;
+	scanAngle = fMaster->scanAngle;
+	fCenterVector = fMaster->fCenterVector;
+	for(int a = 0; a < 3; a++){
+		gridWid[a] = fMaster->gridWid[a];
+		gridMin[a] = fMaster->gridMin[a];
+		gridBins[a] = fMaster->gridBins[a];
 	}
+	verbosity = fMaster->verbosity;
+}
+
+
+//splitmix64 step
+static uint64_t mix64(uint64_t z){
+	z += 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+void L200ParticleGenerator::seedEvent(G4int eventInVoxel){
+	//splitmix64 of (seedBase, voxel, event): an event gets the same random numbers no matter
+	//which shard/thread/run it ends up in (needed for g4simple-merge to reproduce a single job).
+	//Fields hashed one after the other, so no voxel index or event count can collide w/ another pair
+	uint64_t z = mix64(mix64(mix64((uint64_t)seedBase) ^ (uint64_t)currentVoxel.index) ^ (uint64_t)eventInVoxel);
+	long seeds[3];
+	for(int i = 0; i < 2; i++){
+		uint64_t h = mix64(z + i);
+		seeds[i] = (long)(h & 0x7FFFFFFF) | 1;	//positive & non-zero (0 terminates the list)
+	}
+	seeds[2] = 0;
+	G4Random::setTheSeeds(seeds);
+}
 
-    //particle direction, position, and energy sent to ParticleGun
-    fParticleGun->SetParticlePosition(fCurrentPosition);
-    fParticleGun->SetParticleMomentumDirection(fDirection);
-    fParticleGun->SetParticleEnergy(fCurrentEnergy);
-    fParticleGun->SetNumberOfParticles(1);
 
-    //vertex generated by ParticleGun
-    fParticleGun->GeneratePrimaryVertex(event);
+namespace {
+	//Sobol direction numbers (32 bit) for 5 dimensions; dim 0: van der Corput,
+	//dims 1-4 from the primitive polynomials & initial m of Joe & Kuo (new-joe-kuo-6.21201)
+	struct SobolTable{
+		uint32_t v[5][32];
+		SobolTable(){
+			const G4int s[5] = {0, 1, 2, 3, 3};
+			const G4int a[5] = {0, 0, 1, 1, 2};
+			const uint32_t m[5][3] = {{0,0,0}, {1,0,0}, {1,3,0}, {1,3,1}, {1,1,1}};
+			for(G4int k = 0; k < 32; k++) v[0][k] = (uint32_t)1 << (31-k);
+			for(G4int d = 1; d < 5; d++){
+				for(G4int k = 0; k < 32; k++){
+					if(k < s[d]){
+						v[d][k] = m[d][k] << (31-k);
+						continue;
+					}
+					v[d][k] = v[d][k-s[d]] ^ (v[d][k-s[d]] >> s[d]);
+					for(G4int j = 1; j < s[d]; j++){
+						if((a[d] >> (s[d]-1-j)) & 1) v[d][k] ^= v[d][k-j];
+					}
+				}
+			}
+		}
+	};
+	const SobolTable sobolTable;
 }
 
 
+void L200ParticleGenerator::qmcSample(G4int eventInVoxel, G4int iPhoton, G4double* x){
+	L200ParticleGenerator* steered = (fMaster != NULL) ? fMaster : this;
+	G4int R = steered->qmcReplicates;
+	G4int replicate = eventInVoxel % R;
+	uint32_t n = (uint32_t)(eventInVoxel / R)*steered->photonsPerEvent + iPhoton;	//point within the replicate
 
+	//digital shift (random per voxel & replicate, same on every thread/shard): fields mixed in one after the other as in seedEvent
+	uint64_t z = mix64(mix64(mix64((uint64_t)seedBase ^ 0x5B0B01ULL) ^ (uint64_t)currentVoxel.index) ^ (uint64_t)replicate);
+	for(G4int d = 0; d < 5; d++){
+		uint32_t point = (uint32_t)mix64(z + d);
+		for(G4int k = 0; k < 32; k++){
+			if((n >> k) & 1) point ^= sobolTable.v[d][k];
+		}
+		x[d] = (point + 0.5)/4294967296.;	//never exactly 0 or 1
+	}
+}
 
 
+G4int L200ParticleGenerator::getPhotonsInEvent(G4int eventInVoxel){
+	//batches repeat the same pattern of events (last one of a batch may be short)
+	G4int local = eventInVoxel % getEventsPerVoxel();
+	return std::min(photonsPerEvent, getCurrentPhotonsPerVoxel() - local*photonsPerEvent);
+}
 
 
+void L200ParticleGenerator::GeneratePrimaryVertex(G4Event *event)
+{
+	if(fMaster != NULL) syncFromMaster();
+	L200ParticleGenerator* steered = (fMaster != NULL) ? fMaster : this;	//the one holding voxel list & abort flags
+	if(steered->adjointPhotons > 0){
+		GenerateAdjointVertex(event);
+		return;
+	}
+	if(steered->patchPhotons > 0){
+		GeneratePatchVertex(event);
+		return;
+	}
+	std::atomic<G4bool>* voxelAborted = &steered->abortVoxel;
+	uint64_t occupancy = currentOccupancy;
+
+	G4int eventInVoxel = event->GetEventID();
+	G4int eventsPerVoxel = steered->getEventsPerVoxel();
+	if(!steered->voxelList.empty()){	//single BeamOn mode: voxel from event ID
+		size_t iVoxel = event->GetEventID() / eventsPerVoxel;
+		currentVoxel = steered->voxelList.at(iVoxel);
+		voxelAborted = &steered->voxelListAborted[iVoxel];
+		occupancy = steered->getOccupancy(currentVoxel.index);
+		eventInVoxel -= iVoxel*eventsPerVoxel;
+	}
+	seedBase = steered->seedBase;
+	seedEvent(eventInVoxel + steered->eventOffset);
+
+	//photons of this event: photonsPerEvent, rest of the voxel in the last one
+	G4int voxelPhotons = (currentVoxel.nPhotons > 0) ? currentVoxel.nPhotons : (G4int)steered->fNParticles;
+	G4int nPhotons = std::min(steered->photonsPerEvent, voxelPhotons - eventInVoxel*steered->photonsPerEvent);
+
+	for(G4int iPhoton = 0; iPhoton < nPhotons; iPhoton++){
+		if(*voxelAborted) return;		//dont mess around any more with a aborted voxel.
+
+	    fParticleGun->SetParticlePolarization(G4ThreeVector(2*G4UniformRand()-1,2*G4UniformRand()-1,2*G4UniformRand()-1 ) );
+
+	    //what is the particle
+	    fParticleGun->SetParticleDefinition(G4OpticalPhoton::OpticalPhotonDefinition());
+	    //determine particle momentum direction
+	    G4double qmc[5];
+	    if(steered->useQmc) qmcSample(eventInVoxel + steered->eventOffset, iPhoton, qmc);
+	    G4double weight = 1.;
+	    if(importanceFraction <= 0) DirectionDecider(steered->useQmc ? qmc+3 : NULL);
+
+	    //determine particle position
+	    PositionDecider(currentVoxel, steered->useOccupancyMask ? &occupancy : NULL, steered->useQmc ? qmc : NULL);
+	    //biased direction depends on the position (pseudo random even w/ QMC: the box changes per photon)
+	    if(importanceFraction > 0 && !larFailed) weight = BiasedDirectionDecider();
+		if(larFailed){		//fail bit arrived from position decider; only this photon is lost
+			if(abortOnNonlar){
+				*voxelAborted = true;
+				if(verbosity >= 1) G4cout << "Aborting voxel "<<currentVoxel<<G4endl;
+				return;		//go out of primary production immediately
+			}
+			continue;
+		}
 
+	    //particle direction, position, and energy sent to ParticleGun
+	    fParticleGun->SetParticlePosition(fCurrentPosition);
+	    fParticleGun->SetParticleMomentumDirection(fDirection);
+	    fParticleGun->SetParticleEnergy(fCurrentEnergy);
+	    fParticleGun->SetNumberOfParticles(1);
 
+	    //vertex generated by ParticleGun (one vertex per photon)
+	    fParticleGun->GeneratePrimaryVertex(event);
+	    //tracks get the vertex weight; WLS secondaries inherit it from their parent
+	    if(weight != 1.) event->GetPrimaryVertex(event->GetNumberOfPrimaryVertex()-1)->SetWeight(weight);
+	}
+}
 
 
+void L200ParticleGenerator::GenerateAdjointVertex(G4Event *event)
+{
+	//adjoint source: a photon hitting a shroud wall from the LAr is detected w/ fiberDetProb * fiberAtt (z) for both
+	//wavelengths, whatever its direction --> emission w/ the cosine law into the LAr, weight pi * area * response.
+	//Half of them are 128 nm (direct hits), half 450 nm (for the reverse TPB step @ the WLSR), so 2x the weight
+	lookupDetector();
+	if(fDetector == NULL){
+		G4Exception("L200ParticleGenerator::GenerateAdjointVertex","adjointNeedsL200",FatalException,
+			"/scan/adjoint needs the L200 geometry (fiber shroud source)");
+		return;
+	}
+	G4double detProb = L200OpBoundaryProcess::getFiberHitProb();
+	G4int nPhotons = std::min(photonsPerEvent, adjointPhotons - event->GetEventID()*photonsPerEvent);
+
+	for(G4int iPhoton = 0; iPhoton < nPhotons; iPhoton++){
+		G4ThreeVector pos, normal;
+		G4double zFromBottom, halfHeight;
+		G4double area = fDetector->SampleShroudSurface(pos, normal, zFromBottom, halfHeight);
+		G4double response = detProb*0.5*(L200OpBoundaryProcess::fiberIntensity(zFromBottom)
+			+ L200OpBoundaryProcess::fiberIntensity(2.*halfHeight - zFromBottom));
+		if(response <= 0) continue;
+		G4bool vuv = G4UniformRand() < 0.5;
+		fDirection = LambertianDirection(normal);
+
+		G4ThreeVector pol = fDirection.orthogonal().unit();
+		pol.rotate(2*pi*G4UniformRand(), fDirection);
+		fParticleGun->SetParticleDefinition(G4OpticalPhoton::OpticalPhotonDefinition());
+		fParticleGun->SetParticlePolarization(pol);
+		fParticleGun->SetParticlePosition(pos + 1e-3*mm*normal);	//just inside the LAr
+		fParticleGun->SetParticleMomentumDirection(fDirection);
+		fParticleGun->SetParticleEnergy(LambdaE/(vuv ? fLArWL : 450*nm));
+		fParticleGun->SetNumberOfParticles(1);
+		fParticleGun->GeneratePrimaryVertex(event);
+		event->GetPrimaryVertex(event->GetNumberOfPrimaryVertex()-1)->SetWeight(2*pi*area*response);
+	}
+}
 
 
+void L200ParticleGenerator::setPatchSource(const G4double* rzPhi, G4int N){
+	for(int i = 0; i < 6 && rzPhi != NULL; i++) patch[i] = rzPhi[i];
+	patchPhotons = (N > 0) ? N : 0;
+}
+
+
+void L200ParticleGenerator::GeneratePatchVertex(G4Event *event)
+{
+	//as OpWLS in the WLSR TPB: isotropic 450 nm photons anywhere in the layer
+	G4int nPhotons = std::min(photonsPerEvent, patchPhotons - event->GetEventID()*photonsPerEvent);
+	for(G4int iPhoton = 0; iPhoton < nPhotons; iPhoton++){
+		G4double r = std::sqrt(patch[0]*patch[0] + G4UniformRand()*(patch[1]*patch[1] - patch[0]*patch[0]));
+		G4double z = patch[2] + G4UniformRand()*(patch[3] - patch[2]);
+		G4double phi = patch[4] + G4UniformRand()*(patch[5] - patch[4]);
+		DirectionDecider();
+
+		G4ThreeVector pol = fDirection.orthogonal().unit();
+		pol.rotate(2*pi*G4UniformRand(), fDirection);
+		fParticleGun->SetParticleDefinition(G4OpticalPhoton::OpticalPhotonDefinition());
+		fParticleGun->SetParticlePolarization(pol);
+		fParticleGun->SetParticlePosition(G4ThreeVector(r*cos(phi), r*sin(phi), z));
+		fParticleGun->SetParticleMomentumDirection(fDirection);
+		fParticleGun->SetParticleEnergy(LambdaE/(450*nm));
+		fParticleGun->SetNumberOfParticles(1);
+		fParticleGun->GeneratePrimaryVertex(event);
+	}
+}
@@ -6,6 +6,9 @@
 #include "G4UIcmdWith3VectorAndUnit.hh"
 #include "G4UIcmdWithAString.hh"
 #include "G4UIcmdWithABool.hh"
+#include "G4UIparameter.hh"
+
+#include <sstream>
 
 #include "L200ParticleGenerator.hh"
 #include "L200ParticleGeneratorMessenger.hh"
@@ -16,7 +19,8 @@
 L200ParticleGeneratorMessenger::L200ParticleGeneratorMessenger(L200ParticleGenerator *generator)
 : fLiquidArgonGenerator(generator){
 	// /MG/generator/LiquidArgon
-  fLiquidArgonDirectory = new G4UIdirectory("/generator/");
+  //not broadcasted: in MT only the master generator (driven by RunList) is configured
+  fLiquidArgonDirectory = new G4UIdirectory("/generator/", false);
   fLiquidArgonDirectory->SetGuidance("Set to generate optical photons @128 nm in argon inside cryostat");
 
   fLiquidArgonSetRadius= new G4UIcmdWithADoubleAndUnit("/generator/SetRadiusMax",this);
@@ -44,8 +48,63 @@ L200ParticleGeneratorMessenger::L200ParticleGeneratorMessenger(L200ParticleGener
   fLiquidArgonSetBinWidth->SetUnitCategory("Length");
   fLiquidArgonSetBinWidth->SetUnitCandidates("micron mm cm m km");
 
+  fGridCmd = new G4UIcmdWithAString("/generator/grid",this);
+  fGridCmd->SetGuidance("cartesian (default): x/y/z voxels of SetBinWidth, skipped outside the symmetry wedge");
+  fGridCmd->SetGuidance("polar: r/phi/z voxels inside the wedge only (SetDimension: x -> r, y -> phi);");
+  fGridCmd->SetGuidance("written xPos/yPos/zPos are the cartesian centres, xWid/yWid/zWid are dr/dphi(rad)/dz");
+  fGridCmd->SetCandidates("cartesian polar");
+
+  fPointFileCmd = new G4UIcmdWithAString("/generator/pointFile",this);
+  fPointFileCmd->SetGuidance("Shoot from the points of a binary file instead of the voxel grid (memory mapped, not copied)");
+  fPointFileCmd->SetGuidance("Records of 32 bytes, native byte order: double x, y, z (mm); uint32 nPhotons (0: SetNParticles); uint32 unused");
+  fPointFileCmd->SetGuidance("voxelIndex of the output rows is the record index");
+
+  fRadialWidthCmd = new G4UIcmdWithADoubleAndUnit("/generator/SetRadialWidth",this);
+  fRadialWidthCmd->SetGuidance("Polar grid: voxel size in r (default: SetBinWidth)");
+  fRadialWidthCmd->SetDefaultUnit("cm");
+  fRadialWidthCmd->SetUnitCategory("Length");
+
+  fPhiWidthCmd = new G4UIcmdWithADoubleAndUnit("/generator/SetPhiWidth",this);
+  fPhiWidthCmd->SetGuidance("Polar grid: voxel size in phi, rounded to fit the symmetry wedge (default: whole wedge)");
+  fPhiWidthCmd->SetDefaultUnit("deg");
+  fPhiWidthCmd->SetUnitCategory("Angle");
+
+  fZWidthCmd = new G4UIcmdWithADoubleAndUnit("/generator/SetZWidth",this);
+  fZWidthCmd->SetGuidance("Polar grid: voxel size in z (default: SetBinWidth)");
+  fZWidthCmd->SetDefaultUnit("cm");
+  fZWidthCmd->SetUnitCategory("Length");
+
   fLiquidArgonSetNParticles = new G4UIcmdWithADouble("/generator/SetNParticles",this);
-  fLiquidArgonSetNParticles->SetGuidance("Set number of particles to be generated per event");
+  fLiquidArgonSetNParticles->SetGuidance("Set number of photons to be generated per voxel");
+
+  fPhotonsPerEventCmd = new G4UIcmdWithAnInteger("/generator/photonsPerEvent",this);
+  fPhotonsPerEventCmd->SetGuidance("Nr of independent photons (position, direction, polarization) put into one G4Event");
+  fPhotonsPerEventCmd->SetGuidance("SetNParticles stays the nr of photons per voxel; default 1");
+  fPhotonsPerEventCmd->SetParameterName("N", false);
+  fPhotonsPerEventCmd->SetRange("N > 0");
+
+  fTargetRelErrorCmd = new G4UIcmdWithADouble("/generator/targetRelError",this);
+  fTargetRelErrorCmd->SetGuidance("Repeat a voxel in batches of SetNParticles photons until the binomial relative error of counts/initialNr is below this");
+  fTargetRelErrorCmd->SetGuidance("0 (default): single batch. Only for one run per voxel");
+
+  fMaxPhotonsCmd = new G4UIcmdWithADouble("/generator/maxPhotons",this);
+  fMaxPhotonsCmd->SetGuidance("Max nr of photons per voxel for targetRelError (default: 100*SetNParticles)");
+
+  fQmcCmd = new G4UIcmdWithABool("/generator/qmc",this);
+  fQmcCmd->SetGuidance("true: position & direction from a digitally shifted 5D Sobol sequence per voxel instead of random numbers");
+  fQmcCmd->SetGuidance("The qmcError column gets the error of counts/initialNr from the spread of the replicates");
+
+  fQmcReplicatesCmd = new G4UIcmdWithAnInteger("/generator/qmcReplicates",this);
+  fQmcReplicatesCmd->SetGuidance("Nr of independently shifted Sobol sequences per voxel (default 8; events are dealt round robin)");
+  fQmcReplicatesCmd->SetParameterName("R", false);
+  fQmcReplicatesCmd->SetRange("R > 0");
+
+  fImportanceSamplingCmd = new G4UIcmdWithADouble("/generator/importanceSampling",this);
+  fImportanceSamplingCmd->SetGuidance("Fraction of the photons emitted towards the fiber shrouds (rest isotropic); 0 (default): off");
+  fImportanceSamplingCmd->SetGuidance("Photons carry weight isotropic/sampled density; sumW/initialNr estimates the detection probability");
+  fImportanceSamplingCmd->SetGuidance("(sumW & sumW2 columns). L200 geometry only; not for /scan/singleBeamOn");
+  fImportanceSamplingCmd->SetParameterName("alpha", false);
+  fImportanceSamplingCmd->SetRange("alpha >= 0 && alpha < 1");
 
 
   //example
@@ -65,6 +124,25 @@ L200ParticleGeneratorMessenger::L200ParticleGeneratorMessenger(L200ParticleGener
 
   fAbortNonlarCmd = new G4UIcmdWithABool("/generator/abortOnNonlar",this);
   fAbortNonlarCmd->SetGuidance("true: aborts voxel on single non-LAr hit");
+
+  fShardCmd = new G4UIcommand("/generator/shard",this);
+  fShardCmd->SetGuidance("Only run every <count>-th voxel, starting with the <index>-th (0 <= index < count)");
+  fShardCmd->SetGuidance("Run the same macro & seed with index 0..count-1 and combine the outputs with g4simple-merge");
+  fShardCmd->SetParameter(new G4UIparameter("index", 'i', false));
+  fShardCmd->SetParameter(new G4UIparameter("count", 'i', false));
+
+  fOccupancyMaskCmd = new G4UIcmdWithABool("/generator/occupancyMask",this);
+  fOccupancyMaskCmd->SetGuidance("true: sample the geometry in 4x4x4 points per voxel before the scan, skip voxels w/o LAr");
+  fOccupancyMaskCmd->SetGuidance("and generate photons only in the LAr sub-cells of the others (never aborted; larFraction column)");
+
+  fOccupancyCacheCmd = new G4UIcmdWithAString("/generator/occupancyCache",this);
+  fOccupancyCacheCmd->SetGuidance("File to keep the occupancy mask in; reused as long as grid & geometry are unchanged");
+
+  fArgonClassifierCmd = new G4UIcmdWithAString("/generator/argonClassifier",this);
+  fArgonClassifierCmd->SetGuidance("How primary positions are checked to be in LAr:");
+  fArgonClassifierCmd->SetGuidance("analytic (default): from the L200 geometry dimensions; navigator lookup for other geometries");
+  fArgonClassifierCmd->SetGuidance("navigator: volume lookup; crosscheck: both, reports disagreements (validation)");
+  fArgonClassifierCmd->SetCandidates("analytic navigator crosscheck");
 }
 
 
@@ -80,6 +158,21 @@ L200ParticleGeneratorMessenger::~L200ParticleGeneratorMessenger()
   delete fLiquidArgonSetD;
   delete fSetVerboseCmd;
   delete fAbortNonlarCmd;
+  delete fShardCmd;
+  delete fPhotonsPerEventCmd;
+  delete fTargetRelErrorCmd;
+  delete fMaxPhotonsCmd;
+  delete fQmcCmd;
+  delete fQmcReplicatesCmd;
+  delete fImportanceSamplingCmd;
+  delete fOccupancyMaskCmd;
+  delete fOccupancyCacheCmd;
+  delete fArgonClassifierCmd;
+  delete fGridCmd;
+  delete fPointFileCmd;
+  delete fRadialWidthCmd;
+  delete fPhiWidthCmd;
+  delete fZWidthCmd;
 
 
   delete fLiquidArgonDirectory;		//dir is last
@@ -99,6 +192,21 @@ void L200ParticleGeneratorMessenger::SetNewValue(G4UIcommand *cmd, G4String str)
   else if(cmd == fLiquidArgonSetBinWidth){
     fLiquidArgonGenerator->SetBinWidth(fLiquidArgonSetBinWidth->GetNewDoubleValue(str));
   }
+  else if(cmd == fGridCmd){
+    fLiquidArgonGenerator->SetPolarGrid(str == "polar");
+  }
+  else if(cmd == fPointFileCmd){
+    fLiquidArgonGenerator->SetPointFile(str);
+  }
+  else if(cmd == fRadialWidthCmd){
+    fLiquidArgonGenerator->SetRadialWidth(fRadialWidthCmd->GetNewDoubleValue(str));
+  }
+  else if(cmd == fPhiWidthCmd){
+    fLiquidArgonGenerator->SetPhiWidth(fPhiWidthCmd->GetNewDoubleValue(str));
+  }
+  else if(cmd == fZWidthCmd){
+    fLiquidArgonGenerator->SetZWidth(fZWidthCmd->GetNewDoubleValue(str));
+  }
   else if(cmd == fLiquidArgonSetNParticles){
     fLiquidArgonGenerator->SetNParticles(fLiquidArgonSetNParticles->GetNewDoubleValue(str));
   }
@@ -107,7 +215,31 @@ void L200ParticleGeneratorMessenger::SetNewValue(G4UIcommand *cmd, G4String str)
   }
   else if(cmd == fLiquidArgonSetD){
     fLiquidArgonGenerator->setDimScan(fLiquidArgonSetD->GetNewIntValue(str));
-  }else if(cmd == fSetVerboseCmd){
+  }else if(cmd == fPhotonsPerEventCmd){
+		fLiquidArgonGenerator->SetPhotonsPerEvent(fPhotonsPerEventCmd->GetNewIntValue(str));
+  }else if(cmd == fTargetRelErrorCmd){
+		fLiquidArgonGenerator->SetTargetRelError(fTargetRelErrorCmd->GetNewDoubleValue(str));
+  }else if(cmd == fMaxPhotonsCmd){
+		fLiquidArgonGenerator->SetMaxPhotons(fMaxPhotonsCmd->GetNewDoubleValue(str));
+  }else if(cmd == fQmcCmd){
+		fLiquidArgonGenerator->SetQmc(fQmcCmd->GetNewBoolValue(str));
+  }else if(cmd == fQmcReplicatesCmd){
+		fLiquidArgonGenerator->SetQmcReplicates(fQmcReplicatesCmd->GetNewIntValue(str));
+  }else if(cmd == fImportanceSamplingCmd){
+		fLiquidArgonGenerator->SetImportanceSampling(fImportanceSamplingCmd->GetNewDoubleValue(str));
+  }else if(cmd == fOccupancyMaskCmd){
+		fLiquidArgonGenerator->setOccupancyMask(fOccupancyMaskCmd->GetNewBoolValue(str));
+  }else if(cmd == fOccupancyCacheCmd){
+		fLiquidArgonGenerator->setOccupancyCache(str);
+  }else if(cmd == fArgonClassifierCmd){
+		if(str == "navigator") fLiquidArgonGenerator->setArgonClassifier(L200ParticleGenerator::navigatorClassifier);
+		else if(str == "crosscheck") fLiquidArgonGenerator->setArgonClassifier(L200ParticleGenerator::crosscheckClassifier);
+		else fLiquidArgonGenerator->setArgonClassifier(L200ParticleGenerator::analyticClassifier);
+  }else if(cmd == fShardCmd){
+		G4int index = 0, count = 1;
+		std::istringstream(str) >> index >> count;
+		fLiquidArgonGenerator->setShard(index, count);
+	  }else if(cmd == fSetVerboseCmd){
 		fLiquidArgonGenerator->setVerbosity(fSetVerboseCmd->GetNewIntValue(str));
 	  }else if (cmd = fAbortNonlarCmd){
 		fLiquidArgonGenerator->setAbortOnNonlar(fAbortNonlarCmd->GetNewBoolValue(str));
@@ -2,12 +2,20 @@
 
 #include "G4Timer.hh"
 #include "MapRunAction.hh"
+#include "L200OpBoundaryProcess.hh"
 #include "G4Run.hh"
+#include "G4AutoLock.hh"
+#include "G4EventManager.hh"
+#include "G4Event.hh"
 #include "globals.hh"
 
+#include <algorithm>
 
-MapRunAction::MapRunAction(size_t nrOfVolumeIndices)
-	: G4UserRunAction(), hitCount(nrOfVolumeIndices)
+namespace { G4Mutex mergeMutex = G4MUTEX_INITIALIZER; }
+
+
+MapRunAction::MapRunAction(size_t nrOfVolumeIndices, MapRunAction* master)
+	: G4UserRunAction(), hitCount(nrOfVolumeIndices), master(master), eventsPerVoxel(1), replicateOffset(0), primaryWeightEvent(-1), wlsrTable(NULL), recordDetections(false)
 {
 
 }
@@ -15,18 +23,48 @@ MapRunAction::MapRunAction(size_t nrOfVolumeIndices)
 MapRunAction::~MapRunAction(){}
 
 void MapRunAction::BeginOfRunAction(const G4Run*){
+	L200OpBoundaryProcess::applyWeightFloor();	//implicit capture: OpAbsorption of this thread
+	if(master != NULL){	//worker: take over voxel table layout (set on the master before BeamOn)
+		eventsPerVoxel = master->eventsPerVoxel;
+		voxelHitCount.resize(master->voxelHitCount.size());
+		replicateOffset = master->replicateOffset;
+		replicateWeight.resize(master->replicateWeight.size());
+		adjointSum.resize(master->adjointSum.size());
+	}
 	for(size_t i = 0; i < hitCount.size(); i++){
 		hitCount[i] = 0;	//reset counter
 	}
+	weightSum.assign(hitCount.size(), 0);
+	weightSum2.assign(hitCount.size(), 0);
+	expectedSum.assign(hitCount.size(), 0);
+	primaryWeight.clear();
+	primaryWeightEvent = -1;
+	adjointSum.assign(adjointSum.size(), 0);
+	adjointSum2.assign(adjointSum.size(), 0);
+	adjointHits.assign(adjointSum.size(), 0);
+	adjointEvent.clear();
+	detections.clear();
+	for(size_t i = 0; i < voxelHitCount.size(); i++){
+		voxelHitCount[i].assign(voxelHitCount[i].size(), 0);
+	}
+	for(size_t i = 0; i < replicateWeight.size(); i++){
+		replicateWeight[i].assign(replicateWeight[i].size(), 0);
+	}
 }
 
 void MapRunAction::EndOfRunAction(const G4Run*){
+	flushPrimaryWeights();	//last event
+	if(master != NULL){	//worker: hand over to master; all workers end before the master's EndOfRunAction
+		G4AutoLock lock(&mergeMutex);
+		master->merge(*this);
+		return;
+	}
 	for(size_t i = 0; i < hitCount.size(); i++){//volID starts with one
 		G4cout << "Vol "<<i+1<<" --> "<<hitCount[i] << " counts."<<std::endl;
 	}
 }
 
-void MapRunAction::increment(G4int volID){
+void MapRunAction::increment(G4int volID, G4double weight, G4int primary, G4bool countHit){
 	//can be removed for speedup when we are confident, that no shit is going on
 	if(volID <= 0){
 		G4cout << "ERROR: volID out of bounds: "<<volID<<G4endl;
@@ -34,5 +72,148 @@ void MapRunAction::increment(G4int volID){
 	}
 	G4int index = volID-1;
 	if(index >= hitCount.size()) hitCount.resize(index+1, 0);	//fill up missing intermediates with 0
-	hitCount[index]++;
+	if(countHit) hitCount[index]++;
+	if(index >= weightSum.size()){
+		weightSum.resize(index+1, 0);
+		weightSum2.resize(index+1, 0);
+	}
+	weightSum[index] += weight;
+	G4int eventID = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetEventID();
+	if(primary < 0) weightSum2[index] += weight*weight;
+	else{	//events of a thread come one after the other: a new event ID closes the previous one
+		if(eventID != primaryWeightEvent) flushPrimaryWeights();
+		primaryWeightEvent = eventID;
+		primaryWeight[std::make_pair(index, primary)] += weight;
+	}
+
+	if(!replicateWeight.empty()){
+		std::vector<G4double>& row = replicateWeight[(eventID + replicateOffset) % replicateWeight.size()];
+		if(index >= row.size()) row.resize(index+1, 0);
+		row[index] += weight;
+	}
+
+	if(voxelHitCount.empty() || !countHit) return;
+	G4int voxel = eventID/eventsPerVoxel;
+	std::vector<G4int>& row = voxelHitCount.at(voxel);
+	if(index >= row.size()) row.resize(index+1, 0);
+	row[index]++;
+}
+
+void MapRunAction::addExpected(G4int volID, G4double value){
+	if(volID <= 0){
+		G4Exception("MapRunAction::addExpected","volIDOutOfBounds",RunMustBeAborted,"volume ID of sensitive volume out of bounds: check /g4simple/setVolID in macro");
+	}
+	if(volID > (G4int)expectedSum.size()) expectedSum.resize(volID, 0);
+	expectedSum[volID-1] += value;
+}
+
+void MapRunAction::flushPrimaryWeights(){
+	for(std::map<std::pair<G4int, G4int>, G4double>::const_iterator it = primaryWeight.begin(); it != primaryWeight.end(); ++it){
+		weightSum2[it->first.first] += it->second*it->second;
+	}
+	primaryWeight.clear();
+	for(std::map<std::pair<G4int, G4int>, G4double>::const_iterator it = adjointEvent.begin(); it != adjointEvent.end(); ++it){
+		adjointSum2[it->first.first] += it->second*it->second;
+		adjointHits[it->first.first]++;
+	}
+	adjointEvent.clear();
+}
+
+void MapRunAction::setVoxelTable(size_t nrOfVoxels, G4int eventsPerVoxel){
+	this->eventsPerVoxel = (eventsPerVoxel > 0) ? eventsPerVoxel : 1;
+	voxelHitCount.assign(nrOfVoxels, std::vector<G4int>(hitCount.size(), 0));
+}
+
+G4int MapRunAction::getCount(size_t voxel, G4int volID){
+	const std::vector<G4int>& row = voxelHitCount.at(voxel);
+	return (volID-1 < (G4int)row.size()) ? row[volID-1] : 0;
+}
+
+void MapRunAction::setReplicates(G4int nrOfReplicates, G4int eventOffset){
+	replicateOffset = eventOffset;
+	replicateWeight.assign((nrOfReplicates > 0) ? nrOfReplicates : 0, std::vector<G4double>(hitCount.size(), 0));
+}
+
+void MapRunAction::setAdjointTable(size_t nrOfVoxels){
+	adjointSum.assign(nrOfVoxels, 0);
+	adjointSum2.assign(nrOfVoxels, 0);
+	adjointHits.assign(nrOfVoxels, 0);
+	adjointEvent.clear();
+}
+
+void MapRunAction::addTrackLength(G4int voxel, G4double value, G4int primary){
+	if(voxel < 0 || voxel >= (G4int)adjointSum.size()) return;
+	G4int eventID = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetEventID();
+	if(eventID != primaryWeightEvent) flushPrimaryWeights();
+	primaryWeightEvent = eventID;
+	adjointSum[voxel] += value;
+	adjointEvent[std::make_pair(voxel, primary)] += value;
+}
+
+void MapRunAction::addDetection(G4double weight, G4int primary, G4double lVUV, G4double lVis, const G4int* bounces){
+	Detection detection;
+	detection.eventID = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetEventID();
+	detection.primary = primary;
+	detection.weight = weight;
+	detection.lVUV = lVUV;
+	detection.lVis = lVis;
+	std::copy(bounces, bounces + nrBounceCounters, detection.bounces);
+	detections.push_back(detection);
+}
+
+static G4bool byEvent(const MapRunAction::Detection& a, const MapRunAction::Detection& b){
+	return a.eventID < b.eventID;
+}
+
+const std::vector<MapRunAction::Detection>& MapRunAction::getDetections(){
+	//workers append in the order they end; events are never split over threads
+	std::stable_sort(detections.begin(), detections.end(), byEvent);
+	return detections;
+}
+
+G4double MapRunAction::getReplicateWeight(G4int replicate, G4int volID){
+	const std::vector<G4double>& row = replicateWeight.at(replicate);
+	return (volID-1 < (G4int)row.size()) ? row[volID-1] : 0;
+}
+
+void MapRunAction::merge(const MapRunAction& worker){
+	const std::vector<G4int>& workerCount = worker.hitCount;
+	if(workerCount.size() > hitCount.size()) hitCount.resize(workerCount.size(), 0);
+	for(size_t i = 0; i < workerCount.size(); i++){
+		hitCount[i] += workerCount[i];
+	}
+	if(worker.weightSum.size() > weightSum.size()){
+		weightSum.resize(worker.weightSum.size(), 0);
+		weightSum2.resize(worker.weightSum.size(), 0);
+	}
+	for(size_t i = 0; i < worker.weightSum.size(); i++){
+		weightSum[i] += worker.weightSum[i];
+		weightSum2[i] += worker.weightSum2[i];
+	}
+	if(worker.expectedSum.size() > expectedSum.size()) expectedSum.resize(worker.expectedSum.size(), 0);
+	for(size_t i = 0; i < worker.expectedSum.size(); i++){
+		expectedSum[i] += worker.expectedSum[i];
+	}
+	for(size_t v = 0; v < worker.adjointSum.size() && v < adjointSum.size(); v++){
+		adjointSum[v] += worker.adjointSum[v];
+		adjointSum2[v] += worker.adjointSum2[v];
+		adjointHits[v] += worker.adjointHits[v];
+	}
+	detections.insert(detections.end(), worker.detections.begin(), worker.detections.end());
+	const std::vector<std::vector<G4int> >& workerTable = worker.voxelHitCount;
+	for(size_t v = 0; v < workerTable.size() && v < voxelHitCount.size(); v++){
+		std::vector<G4int>& row = voxelHitCount[v];
+		if(workerTable[v].size() > row.size()) row.resize(workerTable[v].size(), 0);
+		for(size_t i = 0; i < workerTable[v].size(); i++){
+			row[i] += workerTable[v][i];
+		}
+	}
+	const std::vector<std::vector<G4double> >& workerReplicates = worker.replicateWeight;
+	for(size_t r = 0; r < workerReplicates.size() && r < replicateWeight.size(); r++){
+		std::vector<G4double>& row = replicateWeight[r];
+		if(workerReplicates[r].size() > row.size()) row.resize(workerReplicates[r].size(), 0);
+		for(size_t i = 0; i < workerReplicates[r].size(); i++){
+			row[i] += workerReplicates[r][i];
+		}
+	}
 }
@@ -0,0 +1,130 @@
+#include "PreviewSolver.hh"
+#include "L200DetectorConstruction.hh"
+#include "L200OpBoundaryProcess.hh"
+#include "G4SystemOfUnits.hh"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+PreviewSolver::PreviewSolver(L200DetectorConstruction* detector, G4int nRings, G4int nDirections)
+	: detector(detector), nRings((nRings > 0) ? nRings : 1), nDirections((nDirections > 0) ? nDirections : 1),
+	  hasWLSR(false), wlsrR(0), wlsrZMin(0), wlsrZMax(0), emitted(0), absVUV(-1), absVis(-1), detProb(0)
+{
+}
+
+
+void PreviewSolver::prepare(){
+	absVUV = detector->getlArAbsVUV();
+	absVis = detector->getlArAbsVis();
+	detProb = L200OpBoundaryProcess::getFiberHitProb();
+	response.assign(nRings, 0);
+
+	G4double outerR, zCenter, halfHeight, yield, reflectivity;
+	hasWLSR = detector->GetWLSRTPB(wlsrR, outerR, zCenter, halfHeight) && detector->GetWLSROptics(yield, reflectivity);
+	if(!hasWLSR) return;
+	wlsrZMin = zCenter - halfHeight;
+	wlsrZMax = zCenter + halfHeight;
+	emitted = yield*(1. + reflectivity)/2.;	//half of the TPB light goes into the Tetratex first
+
+	//Lambertian emission from ring i (@ phi = 0): detected directly (direct) or reaching ring j (transfer)
+	std::vector<G4double> direct(nRings, 0);
+	std::vector<std::vector<G4double> > transfer(nRings, std::vector<G4double>(nRings, 0));
+	G4double weight = 1./(nDirections*nDirections);
+	for(G4int i = 0; i < nRings; i++){
+		G4ThreeVector start(wlsrR - 1*um, 0, wlsrZMin + (i + 0.5)*(wlsrZMax - wlsrZMin)/nRings);	//just inside
+		for(G4int iu = 0; iu < nDirections; iu++){
+			//cosine weighted: sin^2 theta uniform around the inward normal (-x)
+			G4double u = (iu + 0.5)/nDirections;
+			G4double sinTheta = std::sqrt(u);
+			G4double cosTheta = std::sqrt(1. - u);
+			for(G4int iv = 0; iv < nDirections; iv++){
+				G4double phi = 2*M_PI*(iv + 0.5)/nDirections;
+				G4ThreeVector dir(-cosTheta, sinTheta*std::cos(phi), sinTheta*std::sin(phi));
+				G4int ring;
+				G4double remaining;
+				direct[i] += weight*traceRay(start, dir, absVis, ring, remaining);
+				if(ring >= 0) transfer[i][ring] += weight*remaining;
+			}
+		}
+	}
+
+	//radiosity: r_i = direct_i + R * sum_j transfer_ij r_j (Jacobi; converges since R * sum_j transfer_ij < 1)
+	response = direct;
+	for(G4int iteration = 0; iteration < 10000; iteration++){
+		std::vector<G4double> next(direct);
+		G4double change = 0;
+		for(G4int i = 0; i < nRings; i++){
+			for(G4int j = 0; j < nRings; j++) next[i] += reflectivity*transfer[i][j]*response[j];
+			change = std::max(change, std::fabs(next[i] - response[i]));
+		}
+		response.swap(next);
+		if(change <= 1e-12) break;
+	}
+}
+
+
+G4double PreviewSolver::detectionProbability(const G4ThreeVector& p) const{
+	//nDirections (cos theta) x 2 nDirections (phi) cells of equal solid angle
+	G4double weight = 1./(2.*nDirections*nDirections);
+	G4double total = 0;
+	for(G4int ic = 0; ic < nDirections; ic++){
+		G4double cosTheta = -1. + 2.*(ic + 0.5)/nDirections;
+		G4double sinTheta = std::sqrt(std::max(0., 1. - cosTheta*cosTheta));
+		for(G4int ip = 0; ip < 2*nDirections; ip++){
+			G4double phi = M_PI*(ip + 0.5)/nDirections;
+			G4ThreeVector dir(sinTheta*std::cos(phi), sinTheta*std::sin(phi), cosTheta);
+			G4int ring;
+			G4double remaining;
+			total += weight*traceRay(p, dir, absVUV, ring, remaining);
+			if(ring >= 0) total += weight*remaining*emitted*response[ring];
+		}
+	}
+	return total;
+}
+
+
+G4double PreviewSolver::traceRay(const G4ThreeVector& p, const G4ThreeVector& dir, G4double absLength, G4int& ring, G4double& remaining) const{
+	ring = -1;
+	remaining = 0;
+
+	//WLSR ahead: from inside the exit of the cylinder, from outside the Cu blocks the way at the entry
+	G4double tWLSR = DBL_MAX;
+	G4bool inside = true;
+	if(hasWLSR){
+		G4double a = dir.perp2();
+		G4double b = p.x()*dir.x() + p.y()*dir.y();
+		G4double c = p.perp2() - wlsrR*wlsrR;
+		G4double disc = b*b - a*c;
+		inside = (c < 0);
+		if(a > 0 && disc >= 0){
+			G4double t = inside ? (-b + std::sqrt(disc))/a : (-b - std::sqrt(disc))/a;
+			G4double z = p.z() + t*dir.z();
+			if(t > 0 && z >= wlsrZMin && z <= wlsrZMax) tWLSR = t;
+		}
+	}
+
+	//shroud walls up to there: entry detects w/ detProb, the rest passes through the tube
+	const G4double nudge = 1*um;
+	G4double detected = 0;
+	G4double survive = 1.;
+	G4double t = 0;
+	G4double length, zFromBottom, halfHeight;
+	for(G4int crossing = 0; crossing < 8; crossing++){
+		if(detector->HitShroud(p + (t + nudge)*dir, dir, length, zFromBottom, halfHeight) == NULL || t + nudge + length >= tWLSR) break;
+		t += nudge + length;
+		G4double attenuation = (absLength > 0) ? std::exp(-t/absLength) : 1.;
+		detected += survive*attenuation*detProb*0.5*(L200OpBoundaryProcess::fiberIntensity(zFromBottom)
+			+ L200OpBoundaryProcess::fiberIntensity(2.*halfHeight - zFromBottom));
+		survive *= 1. - detProb;
+		if(detector->HitShroud(p + (t + nudge)*dir, dir, length, zFromBottom, halfHeight) == NULL) break;	//exit of the tube
+		t += nudge + length;
+	}
+
+	if(tWLSR < DBL_MAX && inside){
+		G4double z = p.z() + tWLSR*dir.z();
+		ring = std::min(nRings - 1, (G4int)((z - wlsrZMin)/(wlsrZMax - wlsrZMin)*nRings));
+		remaining = survive*((absLength > 0) ? std::exp(-tWLSR/absLength) : 1.);
+	}
+	return detected;
+}
@@ -2,18 +2,140 @@
 #include "RunList.hh"
 #include "G4RunManager.hh"
 #include "g4root.hh"
+#include "G4UIparameter.hh"
+#include "Randomize.hh"
+#include "G4UImanager.hh"
+#include "L200DetectorConstruction.hh"
+#include "L200OpBoundaryProcess.hh"
+#include "PreviewSolver.hh"
+
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <atomic>
+#include <new>
+#include <cstring>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 RunList::RunList(L200ParticleGenerator* generator, MapRunAction* mra)
-	: generator(generator), mra(mra), filename("test.root")
+	: generator(generator), mra(mra), filename("test.root"), writeDetections(false), singleBeamOn(false),
+	  checkpointEvery(1), voxelsSinceCheckpoint(0), rowsWritten(0), sweepIndex(0), detector(NULL),
+	  adaptiveThreshold(0), adaptiveMinWidth(0), workerProcesses(0), adjointPhotons(0),
+	  wlsrPhotons(0), wlsrZBins(0), wlsrPhiBins(0), preview(false), previewRings(50), previewDirections(64)
 {
  	analysis = G4Root::G4AnalysisManager::Instance();
     //openFile();
 
-	writeDir = new G4UIdirectory("/write/");
+	writeDir = new G4UIdirectory("/write/", false);	//master only (MT)
   writeDir->SetGuidance("Output file properties");
 
   writeFilename= new G4UIcmdWithAString("/write/filename",this);
   writeFilename->SetGuidance("Set filename for root output file");
+
+  detectionsCmd = new G4UIcmdWithABool("/write/detections",this);
+  detectionsCmd->SetGuidance("true: also write every detected photon (weight, LAr path at 128 nm & 450 nm) to the detections ntuple;");
+  detectionsCmd->SetGuidance("g4simple-reweight turns that into maps for other absorption lengths");
+  detectionsCmd->SetDefaultValue(true);
+
+	scanDir = new G4UIdirectory("/scan/", false);	//master only (MT)
+  scanDir->SetGuidance("How the voxels are run through");
+
+  singleBeamOnCmd = new G4UIcmdWithABool("/scan/singleBeamOn",this);
+  singleBeamOnCmd->SetGuidance("true: all voxels in a single BeamOn; each event is mapped to its voxel via the event ID");
+  singleBeamOnCmd->SetGuidance("false (default): one BeamOn per voxel");
+  singleBeamOnCmd->SetDefaultValue(true);
+
+  adjointCmd = new G4UIcmdWithAnInteger("/scan/adjoint",this);
+  adjointCmd->SetGuidance("Adjoint mode: N photons start on the fiber shroud walls (weighted w/ fiberAtt & fiberDetProb) and");
+  adjointCmd->SetGuidance("are traced w/ the same optics, incl. the TPB step of the WLSR in reverse (450 nm -> 128 nm).");
+  adjointCmd->SetGuidance("Their 128 nm track length per voxel gives the whole map in one run (sumW/initialNr). 0 (default): off");
+  adjointCmd->SetParameterName("N", false);
+  adjointCmd->SetRange("N >= 0");
+
+  wlsrTableCmd = new G4UIcommand("/scan/wlsrTable",this);
+  wlsrTableCmd->SetGuidance("Two-stage transport: first <photons> TPB photons (450 nm, isotropic) per patch of the WLSR give a table");
+  wlsrTableCmd->SetGuidance("of detection probabilities (<nZ> x <nPhi> patches in the symmetry wedge); then every 128 nm photon");
+  wlsrTableCmd->SetGuidance("reaching the TPB scores WLSMEANNUMBERPHOTONS x table value into sumW (not counts) and is killed.");
+  wlsrTableCmd->SetGuidance("The table is rebuilt when geometry or visible optics change; <cacheFile> keeps it between jobs. photons 0: off");
+  wlsrTableCmd->SetParameter(new G4UIparameter("photons", 'i', false));
+  wlsrTableCmd->SetParameter(new G4UIparameter("nZ", 'i', false));
+  wlsrTableCmd->SetParameter(new G4UIparameter("nPhi", 'i', false));
+  wlsrTableCmd->SetParameter(new G4UIparameter("cacheFile", 's', true));
+  wlsrTableCmd->GetParameter(3)->SetDefaultValue("");
+
+  previewCmd = new G4UIcommand("/scan/preview",this);
+  previewCmd->SetGuidance("Resolution of g4simple --preview: <rings> z bins of the WLSR for the radiosity system and");
+  previewCmd->SetGuidance("<directions> x 2<directions> rays per voxel (default: 50 64)");
+  previewCmd->SetParameter(new G4UIparameter("rings", 'i', false));
+  previewCmd->SetParameter(new G4UIparameter("directions", 'i', false));
+
+  adaptiveCmd = new G4UIcommand("/scan/adaptive",this);
+  adaptiveCmd->SetGuidance("Start from the SetBinWidth grid and keep on halving voxels (along the scanned axes) whose");
+  adaptiveCmd->SetGuidance("counts/initialNr differs by more than <threshold> from a neighbour of the same size,");
+  adaptiveCmd->SetGuidance("down to <minWidth>. Voxel sizes are written to xWid/yWid/zWid. threshold 0: off");
+  adaptiveCmd->SetGuidance("Keep the threshold above the statistical error (see /generator/targetRelError)");
+  adaptiveCmd->SetParameter(new G4UIparameter("threshold", 'd', false));
+  adaptiveCmd->SetParameter(new G4UIparameter("minWidth", 'd', false));
+  G4UIparameter* unitPar = new G4UIparameter("unit", 's', true);
+  unitPar->SetDefaultValue("mm");
+  adaptiveCmd->SetParameter(unitPar);
+
+  checkpointCmd = new G4UIcommand("/write/checkpoint",this);
+  checkpointCmd->SetGuidance("Write a checkpoint every <every> voxels to <file> (+ <file>.rows); continue w/ /run/resume <file>");
+  checkpointCmd->SetGuidance("Only in one-run-per-voxel mode");
+  checkpointCmd->SetParameter(new G4UIparameter("file", 's', false));
+  G4UIparameter* everyPar = new G4UIparameter("every", 'i', true);
+  everyPar->SetDefaultValue(1);
+  checkpointCmd->SetParameter(everyPar);
+
+  resumeCmd = new G4UIcmdWithAString("/run/resume",this);	//goes into the G4RunMessenger directory
+  resumeCmd->SetGuidance("Continue a voxel scan from a checkpoint (/write/checkpoint) after the next voxel written there");
+  resumeCmd->SetGuidance("Use the same macro (geometry, generator, shard) as the interrupted job");
+  resumeCmd->SetToBeBroadcasted(false);
+
+	sweepDir = new G4UIdirectory("/sweep/", false);	//master only (MT)
+  sweepDir->SetGuidance("Repeat the scan for several optical parameters (all combinations) in one job & one output file");
+  sweepDir->SetGuidance("Rows are tagged w/ sweepIndex; the parameters of each index are in the sweep ntuple");
+
+  sweepAbsVUVCmd = new G4UIcmdWithAString("/sweep/lArAbsLength",this);
+  sweepAbsVUVCmd->SetGuidance("List of LAr absorption lengths of LAr scintillation light, unit last (e.g. 20 50 100 cm)");
+
+  sweepAbsVisCmd = new G4UIcmdWithAString("/sweep/visAbsLength",this);
+  sweepAbsVisCmd->SetGuidance("List of LAr absorption lengths of TPB emission light, unit last (e.g. 1 10 m)");
+
+  sweepFiberCmd = new G4UIcmdWithAString("/sweep/fiberDetProb",this);
+  sweepFiberCmd->SetGuidance("List of fiber shroud detection probabilities (e.g. 0.2 0.4 0.6)");
+
+  sweepRayCmd = new G4UIcmdWithAString("/sweep/rayleigh",this);
+  sweepRayCmd->SetGuidance("List of Rayleigh scattering toggles in LAr (e.g. false true)");
+  sweepRayCmd->SetGuidance("Only a change here rebuilds the (optical) physics tables");
+}
+
+
+//list of numbers w/ optional unit as last entry
+static std::vector<G4double> parseList(const G4String& str){
+	std::vector<G4String> tokens;
+	std::istringstream is(str);
+	G4String token;
+	while(is >> token) tokens.push_back(token);
+
+	G4double unit = 1.;
+	G4double number;
+	std::istringstream last(tokens.empty() ? G4String("0") : tokens.back());
+	if(!(last >> number) || !last.eof()){	//not a number --> unit
+		unit = G4UIcommand::ValueOf(tokens.back());
+		tokens.pop_back();
+	}
+	std::vector<G4double> values;
+	for(size_t i = 0; i < tokens.size(); i++) values.push_back(G4UIcommand::ConvertToDouble(tokens[i])*unit);
+	return values;
 }
 
 
@@ -33,6 +155,39 @@ RunList::~RunList(){
 void RunList::SetNewValue(G4UIcommand *cmd, G4String newValue){
 	if(cmd == writeFilename){
 		filename = newValue;
+	}else if(cmd == detectionsCmd){
+		writeDetections = detectionsCmd->GetNewBoolValue(newValue);
+	}else if(cmd == singleBeamOnCmd){
+		singleBeamOn = singleBeamOnCmd->GetNewBoolValue(newValue);
+	}else if(cmd == adjointCmd){
+		adjointPhotons = adjointCmd->GetNewIntValue(newValue);
+	}else if(cmd == previewCmd){
+		std::istringstream(newValue) >> previewRings >> previewDirections;
+	}else if(cmd == wlsrTableCmd){
+		wlsrCache = "";
+		std::istringstream(newValue) >> wlsrPhotons >> wlsrZBins >> wlsrPhiBins >> wlsrCache;
+		if(wlsrZBins < 1 || wlsrPhiBins < 1) wlsrPhotons = 0;
+	}else if(cmd == adaptiveCmd){
+		G4String unit;
+		std::istringstream(newValue) >> adaptiveThreshold >> adaptiveMinWidth >> unit;
+		adaptiveMinWidth *= G4UIcommand::ValueOf(unit);
+	}else if(cmd == checkpointCmd){
+		std::istringstream(newValue) >> checkpointName >> checkpointEvery;
+		if(checkpointEvery < 1) checkpointEvery = 1;
+	}else if(cmd == sweepAbsVUVCmd){
+		sweepAbsVUV = parseList(newValue);
+	}else if(cmd == sweepAbsVisCmd){
+		sweepAbsVis = parseList(newValue);
+	}else if(cmd == sweepFiberCmd){
+		sweepFiber = parseList(newValue);
+	}else if(cmd == sweepRayCmd){
+		std::istringstream is(newValue);
+		G4String token;
+		sweepRay.clear();
+		while(is >> token) sweepRay.push_back(G4UIcommand::ConvertToBool(token));
+	}else if(cmd == resumeCmd){
+		resumeName = newValue;
+		if(checkpointName == "") checkpointName = resumeName;	//keep on checkpointing to the same file
 	}
 }
 
@@ -45,16 +200,353 @@ void print(MapRunAction* mra){
 void RunList::startRuns(){
 	G4RunManager* rm = G4RunManager::GetRunManager();
 	openFile();
+
+	//values from the macro for everything not swept
+	detector = dynamic_cast<L200DetectorConstruction*>(const_cast<G4VUserDetectorConstruction*>(rm->GetUserDetectorConstruction()));
+	baseFiber = L200OpBoundaryProcess::getFiberHitProb();
+	baseAbsVUV = (detector != NULL) ? detector->getlArAbsVUV() : -1;
+	baseAbsVis = (detector != NULL) ? detector->getlArAbsVis() : -1;
+	baseRay = (detector != NULL) ? detector->getlArRay() : false;
+	if(detector == NULL && (!sweepAbsVUV.empty() || !sweepAbsVis.empty() || !sweepRay.empty())){
+		G4Exception("RunList::startRuns","sweepNeedsL200",FatalException,
+			"/sweep/lArAbsLength, visAbsLength & rayleigh need the L200 geometry");
+	}
+	G4int nrSweeps = nrSweepPoints();
+	for(G4int i = 0; i < nrSweeps; i++) writeSweepRow(i);
+	analysis->FillNtupleDColumn(2, 0, generator->getScanAngle());
+	analysis->FillNtupleIColumn(2, 1, generator->isPolarGrid());
+	analysis->AddNtupleRow(2);
+
+	if(writeDetections && (preview || adjointPhotons > 0 || workerProcesses > 0 || adaptiveThreshold > 0 || checkpointName != "" || resumeName != "")){
+		G4Exception("RunList::startRuns","detectionsMode",JustWarning,
+			"/write/detections needs the forward scan in one process w/o adaptive & checkpoints; switched off");
+		writeDetections = false;
+	}
+	if(writeDetections && wlsrPhotons > 0){
+		G4Exception("RunList::startRuns","detectionsPartial",JustWarning,
+			"/write/detections: WLSR table scores are not in the detections ntuple (expected values, no photons)");
+	}
+	mra->setRecordDetections(writeDetections);
+
+	if(preview){
+		if(detector == NULL){
+			G4Exception("RunList::startRuns","previewNeedsL200",FatalException,"--preview needs the L200 geometry");
+		}
+		if(adjointPhotons > 0 || wlsrPhotons > 0 || adaptiveThreshold > 0 || checkpointName != "" || resumeName != "" || workerProcesses > 0){
+			G4Exception("RunList::startRuns","previewOnly",JustWarning,
+				"--preview runs no Monte Carlo: adjoint, wlsrTable, adaptive, checkpoint/resume & --workers are ignored");
+		}
+		for(sweepIndex = 0; sweepIndex < nrSweeps; sweepIndex++){
+			applySweepPoint(sweepIndex);
+			runPreview();
+		}
+		std::cout << "Runs done "<<std::endl;
+		return;
+	}
+
+	G4double innerR, outerR, zCenter, halfHeight;
+	if(wlsrPhotons > 0 && (adjointPhotons > 0 || singleBeamOn)){
+		G4Exception("RunList::startRuns","wlsrTableMode",JustWarning,
+			"/scan/wlsrTable is for the forward scan w/ one run per voxel; ignored for /scan/adjoint & /scan/singleBeamOn");
+		wlsrPhotons = 0;
+	}
+	if(wlsrPhotons > 0 && (detector == NULL || !detector->GetWLSRTPB(innerR, outerR, zCenter, halfHeight))){
+		G4Exception("RunList::startRuns","wlsrTableNoTPB",JustWarning,
+			"/scan/wlsrTable needs the L200 geometry w/ TPB on the WLSR; ignored");
+		wlsrPhotons = 0;
+	}
+
+	if(adjointPhotons > 0){
+		if(detector == NULL || generator->hasPointFile()){
+			G4Exception("RunList::startRuns","adjointNeedsGrid",FatalException,
+				"/scan/adjoint needs the L200 geometry and a voxel grid (no /generator/pointFile)");
+		}
+		if(singleBeamOn || adaptiveThreshold > 0 || checkpointName != "" || resumeName != "" || workerProcesses > 0
+				|| generator->getTargetRelError() > 0 || generator->getQmcReplicates() > 0 || generator->getImportanceSampling() > 0){
+			G4Exception("RunList::startRuns","adjointOnly",JustWarning,
+				"/scan/adjoint is a single run: singleBeamOn, adaptive, checkpoint/resume, --workers, targetRelError, qmc & importanceSampling are ignored");
+		}
+		for(sweepIndex = 0; sweepIndex < nrSweeps; sweepIndex++){
+			applySweepPoint(sweepIndex);
+			runAdjoint(rm);
+		}
+		std::cout << "Runs done "<<std::endl;
+		return;
+	}
+
+	if(singleBeamOn){
+		if(checkpointName != "" || resumeName != ""){
+			G4Exception("RunList::startRuns","noCheckpointSingleRun",JustWarning,
+				"/write/checkpoint & /run/resume need one run per voxel; ignored for /scan/singleBeamOn");
+		}
+		if(generator->getTargetRelError() > 0){
+			G4Exception("RunList::startRuns","noTargetErrorSingleRun",JustWarning,
+				"/generator/targetRelError needs one run per voxel; ignored for /scan/singleBeamOn");
+		}
+		if(adaptiveThreshold > 0){
+			G4Exception("RunList::startRuns","noAdaptiveSingleRun",JustWarning,
+				"/scan/adaptive needs one run per voxel; ignored for /scan/singleBeamOn");
+		}
+		if(workerProcesses > 0){
+			G4Exception("RunList::startRuns","noWorkersSingleRun",JustWarning,
+				"--workers needs one run per voxel; ignored for /scan/singleBeamOn");
+		}
+		if(generator->getImportanceSampling() > 0){
+			G4Exception("RunList::startRuns","noImportanceSingleRun",JustWarning,
+				"/generator/importanceSampling needs one run per voxel; switched off for /scan/singleBeamOn");
+			generator->SetImportanceSampling(0);
+		}
+		for(sweepIndex = 0; sweepIndex < nrSweeps; sweepIndex++){
+			applySweepPoint(sweepIndex);
+			startSingleRun(rm);
+		}
+		return;
+	}
+	if(workerProcesses > 0 && (adaptiveThreshold > 0 || checkpointName != "" || resumeName != "")){
+		G4Exception("RunList::startRuns","workersNotSupported",JustWarning,
+			"--workers is not supported w/ /scan/adaptive, /write/checkpoint or /run/resume; running in a single process");
+		workerProcesses = 0;
+	}
+	if(adaptiveThreshold > 0 && generator->hasPointFile()){
+		G4Exception("RunList::startRuns","adaptivePoints",JustWarning,"/scan/adaptive needs a grid; ignored for /generator/pointFile");
+		adaptiveThreshold = 0;
+	}
+	if(adaptiveThreshold > 0){
+		if(checkpointName != "" || resumeName != ""){
+			G4Exception("RunList::startRuns","noCheckpointAdaptive",JustWarning,
+				"/write/checkpoint & /run/resume are not supported for /scan/adaptive; ignored");
+			checkpointName = "";
+			resumeName = "";
+		}
+		if(generator->getShardCount() > 1){	//refined indices come from the parent: still unique for g4simple-merge
+			G4Exception("RunList::startRuns","adaptiveShards",JustWarning,
+				"/scan/adaptive w/ /generator/shard: neighbours in other shards are not compared");
+		}
+	}
+	std::vector<std::string> resumedRows;
+	if(resumeName != "") resumedRows = resume();
+	if(checkpointName != "") openCheckpoint(resumedRows);
+	for(; sweepIndex < nrSweeps; sweepIndex++){
+		applySweepPoint(sweepIndex);
+		if(wlsrPhotons > 0) prepareWlsrTable(rm);
+		if(adaptiveThreshold > 0){
+			runAdaptive(rm);
+			generator->clearVoxelList();
+			continue;
+		}
+		if(workerProcesses > 0){
+			runWorkerPool(rm);
+			generator->clearVoxelList();
+			continue;
+		}
+		while(true){
+			G4int nrPrimaries = generator->nextVoxel();	//photons
+			if(nrPrimaries == 0) break;
+			runVoxel(rm, nrPrimaries);
+			if(checkpointName != "" && ++voxelsSinceCheckpoint >= checkpointEvery) writeCheckpoint();
+		}
+		generator->clearVoxelList();	//rewind for the next sweep point
+	}
+	if(checkpointName != "") writeCheckpoint();
+	mra->setWlsrTable(NULL);
+	std::cout << "Runs done "<<std::endl;
+}
+
+void RunList::prepareWlsrTable(G4RunManager* rm){
+	G4double innerR, outerR, zCenter, halfHeight;
+	detector->GetWLSRTPB(innerR, outerR, zCenter, halfHeight);
+
+	//everything the table depends on; lArAbsLength does not matter (no 128 nm light in stage 1)
+	std::ostringstream key;
+	key << std::setprecision(10) << generator->geometryKey(false) << "_" << wlsrPhotons << "_" << wlsrZBins << "_" << wlsrPhiBins << "_" << generator->getScanAngle()
+		<< "_" << detector->getlArAbsVis() << "_" << detector->getlArRay() << "_" << L200OpBoundaryProcess::getFiberHitProb();
+	if(key.str() == wlsrKey){	//same as the last sweep point
+		mra->setWlsrTable(&wlsrTable);
+		return;
+	}
+	wlsrKey = key.str();
+	mra->setWlsrTable(NULL);	//stage 1 runs w/ the full optics
+	if(wlsrCache != "" && wlsrTable.read(wlsrCache, wlsrKey)){
+		std::cout << " (0) WLSR response table read from "<<wlsrCache<<std::endl;
+		mra->setWlsrTable(&wlsrTable);
+		return;
+	}
+
+	//the engine is left as it was: the scan (seeds, shards, checkpoints) does not depend on whether the table was built or read
+	std::ostringstream engineState;
+	G4Random::getTheEngine()->put(engineState);
+
+	wlsrTable.setLayout(wlsrZBins, wlsrPhiBins, zCenter - halfHeight, zCenter + halfHeight, generator->getScanAngle());
+	for(G4int i = 0; i < wlsrTable.size(); i++){
+		G4double rzPhi[6] = {innerR, outerR, 0, 0, 0, 0};
+		wlsrTable.getPatch(i, rzPhi[2], rzPhi[3], rzPhi[4], rzPhi[5]);
+		generator->setPatchSource(rzPhi, wlsrPhotons);
+		rm->BeamOn(generator->getPatchEvents());
+		wlsrTable.setValue(i, mra->getWeightSum(1)/wlsrPhotons);	//volume ID 1 as in runVoxel
+	}
+	generator->setPatchSource(NULL, 0);
+	std::cout << " (0) WLSR response table built: "<<wlsrTable.size()<<" patches x "<<wlsrPhotons<<" photons"<<std::endl;
+
+	std::istringstream restore(engineState.str());
+	G4Random::getTheEngine()->get(restore);
+	if(wlsrCache != "") wlsrTable.write(wlsrCache, wlsrKey);
+	mra->setWlsrTable(&wlsrTable);
+}
+
+void RunList::fillDetections(G4int voxelIndex, G4int eventOffset){
+	const std::vector<MapRunAction::Detection>& detections = mra->getDetections();
+	G4int eventsPerVoxel = generator->getEventsPerVoxel();
+	for(size_t i = 0; i < detections.size(); i++){
+		const MapRunAction::Detection& detection = detections[i];
+		G4int voxel = (voxelIndex >= 0) ? voxelIndex : generator->getVoxel(detection.eventID/eventsPerVoxel).index;
+		analysis->FillNtupleIColumn(3, 0, voxel);
+		analysis->FillNtupleIColumn(3, 1, sweepIndex);
+		analysis->FillNtupleIColumn(3, 2, detection.eventID + eventOffset);
+		analysis->FillNtupleIColumn(3, 3, detection.primary);
+		analysis->FillNtupleDColumn(3, 4, detection.weight);
+		analysis->FillNtupleDColumn(3, 5, detection.lVUV);
+		analysis->FillNtupleDColumn(3, 6, detection.lVis);
+		for(G4int b = 0; b < MapRunAction::nrBounceCounters; b++) analysis->FillNtupleIColumn(3, 7 + b, detection.bounces[b]);
+		analysis->AddNtupleRow(3);
+	}
+}
+
+G4int RunList::nrSweepPoints(){
+	return std::max<size_t>(sweepAbsVUV.size(),1)*std::max<size_t>(sweepAbsVis.size(),1)
+		*std::max<size_t>(sweepFiber.size(),1)*std::max<size_t>(sweepRay.size(),1);
+}
+
+void RunList::sweepPoint(G4int index, G4double& absVUV, G4double& absVis, G4double& fiber, G4bool& ray){
+	//mixed radix, rayleigh fastest
+	G4int nRay = std::max<size_t>(sweepRay.size(),1);
+	G4int nFiber = std::max<size_t>(sweepFiber.size(),1);
+	G4int nVis = std::max<size_t>(sweepAbsVis.size(),1);
+	ray = sweepRay.empty() ? baseRay : sweepRay[index % nRay];
+	index /= nRay;
+	fiber = sweepFiber.empty() ? baseFiber : sweepFiber[index % nFiber];
+	index /= nFiber;
+	absVis = sweepAbsVis.empty() ? baseAbsVis : sweepAbsVis[index % nVis];
+	index /= nVis;
+	absVUV = sweepAbsVUV.empty() ? baseAbsVUV : sweepAbsVUV[index];
+}
+
+void RunList::applySweepPoint(G4int index){
+	G4double absVUV, absVis, fiber;
+	G4bool ray;
+	sweepPoint(index, absVUV, absVis, fiber, ray);
+
+	L200OpBoundaryProcess::setFiberHitProb(fiber);	//shared by all threads
+	if(detector != NULL){
+		G4bool rayChanged = (ray != detector->getlArRay());
+		detector->setlArAbsVUV(absVUV);
+		detector->setlArAbsVis(absVis);
+		detector->setlArRay(ray);
+		detector->UpdateLArOptics();
+		if(rayChanged) G4UImanager::GetUIpointer()->ApplyCommand("/run/physicsModified");	//rebuilds OpRayleigh table @ next BeamOn
+	}
+	if(nrSweepPoints() > 1){
+		std::cout << " (0) sweep point "<<index<<": lArAbsLength "<<absVUV/cm<<" cm, visAbsLength "<<absVis/cm
+			<<" cm, fiberDetProb "<<fiber<<", rayleigh "<<ray<<std::endl;
+	}
+}
+
+void RunList::writeSweepRow(G4int index){
+	G4double absVUV, absVis, fiber;
+	G4bool ray;
+	sweepPoint(index, absVUV, absVis, fiber, ray);
+	analysis->FillNtupleIColumn(1, 0, index);
+	analysis->FillNtupleDColumn(1, 1, absVUV);
+	analysis->FillNtupleDColumn(1, 2, absVis);
+	analysis->FillNtupleDColumn(1, 3, fiber);
+	analysis->FillNtupleIColumn(1, 4, ray);
+	G4double vis[3] = {-1, -1, -1}, vuv[3] = {-1, -1, -1};
+	if(detector != NULL) detector->GetReflectivities(vis, vuv);
+	for(G4int i = 0; i < 3; i++){
+		analysis->FillNtupleDColumn(1, 5 + 2*i, vuv[i]);
+		analysis->FillNtupleDColumn(1, 6 + 2*i, vis[i]);
+	}
+	analysis->AddNtupleRow(1);
+}
+
+void RunList::startSingleRun(G4RunManager* rm){
+	G4int nrVoxels = generator->collectVoxels();
+	G4int nrPrimaries = generator->getCurrentPhotonsPerVoxel();
+	G4int nrEvents = generator->getEventsPerVoxel();
+	mra->setVoxelTable(nrVoxels, nrEvents);
+
+	rm->BeamOn(nrVoxels*nrEvents);
+	std::cout << " (0) single run over "<<nrVoxels<<" voxels ended"<<std::endl;
+	if(writeDetections) fillDetections(-1, 0);
+
+	for(G4int i = 0; i < nrVoxels; i++){
+		VoxelResult result;
+		result.counts = mra->getCount(i, 1);	//volume ID 1 as in runVoxel
+		result.photons = nrPrimaries;
+		result.aborted = generator->isVoxelAborted(i);
+		result.qmcError = -1;
+		result.sumW = result.counts;	//no importance sampling here: all weights 1
+		result.sumW2 = result.counts;
+		result.nee = -1;		//no per voxel table
+		writeVoxel(generator->getVoxel(i), result);
+	}
+
+	mra->setVoxelTable(0, 1);
+	generator->clearVoxelList();
+	std::cout << "Runs done "<<std::endl;
+}
+
+
+void RunList::runAdjoint(G4RunManager* rm){
+	//rows for the same voxels as the forward scan (wedge, occupancy mask, shard)
+	std::vector<L200ParticleGenerator::Voxel> voxels;
+	while(generator->nextVoxel() != 0) voxels.push_back(generator->getCurrentVoxel());
+
+	mra->setAdjointTable(generator->getGridSize());
+	generator->setAdjointPhotons(adjointPhotons);
+	rm->BeamOn(generator->getAdjointEvents());
+	generator->setAdjointPhotons(0);
+	std::cout << " (0) adjoint run w/ "<<adjointPhotons<<" photons ended"<<std::endl;
+
+	//polar grid: track length of all mirror images of the wedge is folded in
+	G4double images = generator->getSymmetryImages();
+	for(size_t i = 0; i < voxels.size(); i++){
+		const L200ParticleGenerator::Voxel& voxel = voxels[i];
+		G4double norm = 4*M_PI*voxel.volume()*generator->getLArFraction(voxel)*images;
+		VoxelResult result;
+		result.counts = mra->getAdjointHits(voxel.index);
+		result.photons = adjointPhotons;
+		result.aborted = (norm <= 0);
+		result.qmcError = -1;
+		result.sumW = result.aborted ? 0 : mra->getAdjointSum(voxel.index)/norm;
+		result.sumW2 = result.aborted ? 0 : mra->getAdjointSum2(voxel.index)/(norm*norm);
+		result.nee = -1;
+		writeVoxel(voxel, result);
+	}
+	mra->setAdjointTable(0);
+	generator->clearVoxelList();
+}
+
+void RunList::runPreview(){
+	PreviewSolver solver(detector, previewRings, previewDirections);
+	solver.prepare();
+	G4int voxels = 0;
 	while(true){
 		G4int nrPrimaries = generator->nextVoxel();
 		if(nrPrimaries == 0) break;
-		rm->BeamOn(nrPrimaries);
-		std::cout << " (0) run in voxel "<<generator->getCurrentVoxel()<<" ended: "<<std::endl;
-		print(mra);
-
-		writeRun(nrPrimaries);
+		L200ParticleGenerator::Voxel voxel = generator->getCurrentVoxel();
+		VoxelResult result;
+		result.photons = nrPrimaries;
+		result.sumW = solver.detectionProbability(voxel.pointAt(0.5, 0.5, 0.5))*nrPrimaries;	//expected counts
+		result.sumW2 = 0;		//no statistical error
+		result.counts = -1;		//no photons simulated: expectation in sumW only
+		result.aborted = 0;
+		result.qmcError = -1;
+		result.nee = -1;
+		writeVoxel(voxel, result);
+		voxels++;
 	}
-	std::cout << "Runs done "<<std::endl;
+	std::cout << " (0) preview of "<<voxels<<" voxels done"<<std::endl;
+	generator->clearVoxelList();
 }
 
 
@@ -67,11 +559,61 @@ void RunList::openFile(){
     analysis->CreateNtupleDColumn("xPos");//D for double
     analysis->CreateNtupleDColumn("yPos");
     analysis->CreateNtupleDColumn("zPos");
-    analysis->CreateNtupleIColumn("counts"); //I for int
+    analysis->CreateNtupleIColumn("counts"); //I for int; -1 for --preview (no photons, use sumW)
 	analysis->CreateNtupleIColumn("initialNr"); //I for int
+	analysis->CreateNtupleIColumn("voxelIndex");
+	analysis->CreateNtupleIColumn("sweepIndex");
+	analysis->CreateNtupleDColumn("xWid");
+	analysis->CreateNtupleDColumn("yWid");
+	analysis->CreateNtupleDColumn("zWid");
+	analysis->CreateNtupleDColumn("larFraction");	//LAr part of the voxel (/generator/occupancyMask; 1 otherwise)
+	analysis->CreateNtupleDColumn("qmcError");	///generator/qmc: error of counts/initialNr from the replicates; -1 otherwise
+	analysis->CreateNtupleDColumn("sumW");		//hit weights (/generator/importanceSampling); = counts otherwise
+	analysis->CreateNtupleDColumn("sumW2");
+	analysis->CreateNtupleDColumn("nee");		///optics/nextEventEstimator: expected direct detections after OpWLS; 0 w/ the estimator off, -1 if not available (singleBeamOn, adjoint, preview)
     //more if you want...
 
     analysis->FinishNtuple();
+
+	//parameters of each sweep point (single row w/o sweeps); lengths in G4 units (mm)
+	analysis->CreateNtuple("sweep","optical parameters per sweepIndex");
+	analysis->CreateNtupleIColumn("sweepIndex");
+	analysis->CreateNtupleDColumn("lArAbsLength");
+	analysis->CreateNtupleDColumn("visAbsLength");
+	analysis->CreateNtupleDColumn("fiberDetProb");
+	analysis->CreateNtupleIColumn("rayleigh");
+	analysis->CreateNtupleDColumn("reflCuVUV");		//REFLECTIVITY of the skin surfaces (-1: not built)
+	analysis->CreateNtupleDColumn("reflCuVis");
+	analysis->CreateNtupleDColumn("reflTetraVUV");
+	analysis->CreateNtupleDColumn("reflTetraVis");
+	analysis->CreateNtupleDColumn("reflGeVUV");
+	analysis->CreateNtupleDColumn("reflGeVis");
+	analysis->FinishNtuple();
+
+	//scan layout needed for unfolding the map (single row)
+	analysis->CreateNtuple("meta","scan layout");
+	analysis->CreateNtupleDColumn("symmetryAngle");	//wedge [0, angle] mirrored & rotated by 2*angle covers the circle
+	analysis->CreateNtupleIColumn("polarGrid");
+	analysis->FinishNtuple();
+
+	//one row per detected photon (/write/detections); eventID counts on over the batches of a voxel
+	if(writeDetections){
+		analysis->CreateNtuple("detections","detected photons w/ LAr path lengths");
+		analysis->CreateNtupleIColumn("voxelIndex");
+		analysis->CreateNtupleIColumn("sweepIndex");
+		analysis->CreateNtupleIColumn("eventID");
+		analysis->CreateNtupleIColumn("primary");		//track ID of the primary photon (photons of an event)
+		analysis->CreateNtupleDColumn("weight");
+		analysis->CreateNtupleDColumn("lVUV");		//path in LAr @ 128 nm (mm)
+		analysis->CreateNtupleDColumn("lVis");		//@ 450 nm
+		analysis->CreateNtupleIColumn("nCuVUV");		//reflections on Cu, Tetratex & Ge @ 128 nm & 450 nm
+		analysis->CreateNtupleIColumn("nCuVis");
+		analysis->CreateNtupleIColumn("nTetraVUV");
+		analysis->CreateNtupleIColumn("nTetraVis");
+		analysis->CreateNtupleIColumn("nGeVUV");
+		analysis->CreateNtupleIColumn("nGeVis");
+		analysis->FinishNtuple();
+	}
     analysis->SetFileName(filename);
     std::cout << "Opening file " << analysis->GetFileName() << std::endl;
     analysis->OpenFile();
@@ -83,38 +625,363 @@ void RunList::clearVars(){
 	//leave empty as we do not have vectors
 }
 
-void RunList::writeRun(G4int nrPrimaries){
-	L200ParticleGenerator::Voxel voxel = generator->getCurrentVoxel();
-	voxelX = voxel.xPos + 0.5*voxel.xWid;
-	voxelY = voxel.yPos + 0.5*voxel.yWid;
-	voxelZ = voxel.zPos + 0.5*voxel.zWid;
-	count = (generator->isCurrentVoxelAborted()) ? 0 : mra->getCount(1);	//should now have only cnts in volumes with ID 1 (check macro!!!)
-	initialNr = nrPrimaries;
+void RunList::runVoxel(G4RunManager* rm, G4int nrPrimaries){
+	writeVoxel(generator->getCurrentVoxel(), simulateVoxel(rm, nrPrimaries));
+}
 
-	analysis->FillNtupleDColumn(0, voxelX);		//dont mess up ordering!
-	analysis->FillNtupleDColumn(1, voxelY);
-	analysis->FillNtupleDColumn(2, voxelZ);
-	analysis->FillNtupleIColumn(3, count);
-	analysis->FillNtupleIColumn(4, initialNr);
+RunList::VoxelResult RunList::simulateVoxel(G4RunManager* rm, G4int nrPrimaries){
+	//batches of nrPrimaries photons until the relative error target (if any) or the photon cap is reached
+	G4double target = generator->getTargetRelError();
+	G4double maxPhotons = generator->getMaxPhotons();
+	VoxelResult result;
+	G4int& counts = result.counts;
+	G4int& photons = result.photons;
+	G4int eventsDone = 0;
+	counts = 0;
+	photons = 0;
+	result.sumW = 0;
+	result.sumW2 = 0;
+	result.nee = 0;
+	G4int replicates = generator->getQmcReplicates();
+	std::vector<G4double> replicateWeights(replicates, 0);
+	std::vector<G4double> replicatePhotons(replicates, 0);
+	while(true){
+		generator->setEventOffset(eventsDone);
+		mra->setReplicates(replicates, eventsDone);
+		rm->BeamOn(generator->getEventsPerVoxel());
+		for(G4int r = 0; r < replicates; r++) replicateWeights[r] += mra->getReplicateWeight(r, 1);
+		if(writeDetections) fillDetections(generator->getCurrentVoxel().index, eventsDone);
+		for(G4int e = eventsDone; e < eventsDone + generator->getEventsPerVoxel() && replicates > 0; e++){
+			replicatePhotons[e % replicates] += generator->getPhotonsInEvent(e);
+		}
+		eventsDone += generator->getEventsPerVoxel();
+		photons += nrPrimaries;
+		counts += mra->getCount(1);	//should now have only cnts in volumes with ID 1 (check macro!!!)
+		result.sumW += mra->getWeightSum(1);
+		result.sumW2 += mra->getWeightSum2(1);
+		result.nee += mra->getExpectedSum(1);
+
+		if(target <= 0 || generator->isCurrentVoxelAborted() || photons + nrPrimaries > maxPhotons) break;
+		//sigma(p)/p = sqrt(sumW2 - sumW^2/photons)/sumW w/ p = sumW/photons
+		//(binomial sqrt((1-p)/counts) for unit weights)
+		if(result.sumW > 0 && std::sqrt(std::max(0., result.sumW2 - result.sumW*result.sumW/photons))/result.sumW <= target) break;
+	}
+	generator->setEventOffset(0);
+	mra->setReplicates(0, 0);
+
+	//randomized QMC: standard error of the mean of the replicate estimates
+	result.qmcError = -1;
+	G4double sum = 0, sum2 = 0;
+	G4int used = 0;
+	for(G4int r = 0; r < replicates; r++){
+		if(replicatePhotons[r] <= 0) continue;
+		G4double p = replicateWeights[r]/replicatePhotons[r];
+		sum += p;
+		sum2 += p*p;
+		used++;
+	}
+	if(used >= 2 && !generator->isCurrentVoxelAborted()){
+		G4double mean = sum/used;
+		result.qmcError = std::sqrt(std::max(0., (sum2 - used*mean*mean)/(used*(used-1.))));
+	}
 
-	analysis->AddNtupleRow();
+	std::cout << " (0) run in voxel "<<generator->getCurrentVoxel()<<" ended: "<<std::endl;
+	if(eventsDone > generator->getEventsPerVoxel()) std::cout << "   (1) "<<photons<<" photons, "<<counts<<" counts"<<std::endl;
+	else print(mra);
+	result.aborted = generator->isCurrentVoxelAborted();
+	return result;
+}
 
-	clearVars();
+void RunList::runAdaptive(G4RunManager* rm){
+	typedef std::map<std::vector<long>, size_t> CellLookup;	//integer voxel coordinates (same level) -> cell
+	G4bool axes[3];
+	generator->getScanAxes(axes[0], axes[1], axes[2]);
+
+	//level 0: the regular grid
+	std::vector<ScanCell> level;
+	G4int nrPrimaries = 0;
+	while(true){
+		G4int n = generator->nextVoxel();
+		if(n == 0) break;
+		nrPrimaries = n;
+		ScanCell cell;
+		cell.voxel = generator->getCurrentVoxel();
+		level.push_back(cell);
+	}
+	if(level.empty()) return;
+	if(level[0].voxel.polar) axes[1] = false;	//phi widths are angles (not comparable to minWidth): only r & z refined
+	const L200ParticleGenerator::Voxel& gridOrigin = level[0].voxel;
+	const G4ThreeVector origin(gridOrigin.xPos, gridOrigin.yPos, gridOrigin.zPos);	//grid coordinates (r, phi, z if polar)
+	//index of a refined voxel: gridSize + 8*parent + octant. Unique across shards (no counter), and never
+	//a grid index; voxelIndex is an int column, so the octree depth is limited by that
+	const uint64_t gridSize = generator->getGridSize();
+
+	for(G4int depth = 0; !level.empty(); depth++){
+		for(size_t i = 0; i < level.size(); i++){
+			generator->setCurrentVoxel(level[i].voxel);
+			level[i].result = simulateVoxel(rm, nrPrimaries);
+		}
+
+		//all voxels of a level have the same size
+		const L200ParticleGenerator::Voxel& first = level[0].voxel;
+		G4double wid[3] = {first.xWid, first.yWid, first.zWid};
+		CellLookup lookup;
+		std::vector<std::vector<long> > keys(level.size(), std::vector<long>(3));
+		for(size_t i = 0; i < level.size(); i++){
+			const L200ParticleGenerator::Voxel& v = level[i].voxel;
+			G4ThreeVector rel = G4ThreeVector(v.xPos, v.yPos, v.zPos) - origin;
+			for(int a = 0; a < 3; a++) keys[i][a] = (long)std::floor(rel[a]/wid[a] + 0.5);
+			lookup[keys[i]] = i;
+		}
+
+		std::vector<ScanCell> next;
+		for(size_t i = 0; i < level.size(); i++){
+			const ScanCell& cell = level[i];
+			G4bool refine = false;
+			//aborted voxels (non-LAr inside) carry no probability & are never compared
+			if(!cell.result.aborted){
+				G4double p = cell.result.sumW/cell.result.photons;
+				for(int a = 0; a < 3 && !refine; a++){
+					if(!axes[a] || wid[a]/2 < adaptiveMinWidth) continue;
+					for(int d = -1; d <= 1 && !refine; d += 2){
+						std::vector<long> key = keys[i];
+						key[a] += d;
+						CellLookup::const_iterator nb = lookup.find(key);
+						if(nb == lookup.end() || level[nb->second].result.aborted) continue;
+						const VoxelResult& other = level[nb->second].result;
+						if(std::fabs(p - other.sumW/other.photons) > adaptiveThreshold) refine = true;
+					}
+				}
+			}
+			if(!refine){
+				writeVoxel(cell.voxel, cell.result);
+				continue;
+			}
+
+			//halve along the scanned axes that are still above the min width
+			G4bool split[3];
+			for(int a = 0; a < 3; a++) split[a] = axes[a] && wid[a]/2 >= adaptiveMinWidth;
+			for(int c = 0; c < 8; c++){
+				G4int pos[3] = {c & 1, (c >> 1) & 1, (c >> 2) & 1};
+				if((pos[0] && !split[0]) || (pos[1] && !split[1]) || (pos[2] && !split[2])) continue;
+				ScanCell child;
+				child.voxel = cell.voxel;
+				child.voxel.xWid = split[0] ? wid[0]/2 : wid[0];
+				child.voxel.yWid = split[1] ? wid[1]/2 : wid[1];
+				child.voxel.zWid = split[2] ? wid[2]/2 : wid[2];
+				child.voxel.xPos += pos[0]*child.voxel.xWid;
+				child.voxel.yPos += pos[1]*child.voxel.yWid;
+				child.voxel.zPos += pos[2]*child.voxel.zWid;
+				if(!generator->isInScanRegion(child.voxel)) continue;
+				uint64_t index = gridSize + 8*(uint64_t)cell.voxel.index + c;
+				if(index > (uint64_t)INT_MAX){
+					G4Exception("RunList::runAdaptive","adaptiveIndexOverflow",FatalException,
+						"refined voxel index beyond the int range: raise the min width of /scan/adaptive or coarsen the grid");
+				}
+				child.voxel.index = (uint32_t)index;
+				next.push_back(child);
+			}
+		}
+		std::cout << " (0) adaptive level "<<depth<<": "<<level.size()<<" voxels, "<<next.size()<<" refined voxels next"<<std::endl;
+		level.swap(next);
+	}
 }
 
+void RunList::runWorkerPool(G4RunManager* rm){
+	std::vector<L200ParticleGenerator::Voxel> voxels;	//carry their own photon count (point files)
+	while(generator->nextVoxel() != 0){	//also draws the seed base in the parent --> same for all workers
+		voxels.push_back(generator->getCurrentVoxel());
+	}
+	if(voxels.empty()) return;
 
+	rm->BeamOn(0);	//builds (or rebuilds after a sweep change) the physics tables before forking
 
+	const size_t header = 64;	//queue counter; keeps the results 8 byte aligned
+	size_t bytes = header + voxels.size()*sizeof(PoolResult);
+	void* shared = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(shared == MAP_FAILED){
+		G4Exception("RunList::runWorkerPool","noSharedMemory",FatalException,"mmap of the voxel queue failed");
+	}
+	std::atomic<uint32_t>* nextJob = new(shared) std::atomic<uint32_t>(0);
+	PoolResult* results = reinterpret_cast<PoolResult*>(static_cast<char*>(shared) + header);
+	std::memset(results, 0, voxels.size()*sizeof(PoolResult));
+
+	G4cout << std::flush;	//don't duplicate buffered output in the children
+	std::cout << std::flush;
+	std::vector<pid_t> pids;
+	for(G4int w = 0; w < workerProcesses; w++){
+		pid_t pid = fork();
+		if(pid == 0){
+			while(true){
+				uint32_t job = nextJob->fetch_add(1);
+				if(job >= voxels.size()) break;
+				generator->setCurrentVoxel(voxels[job]);
+				results[job].result = simulateVoxel(rm, generator->getCurrentPhotonsPerVoxel());
+				results[job].done = 1;
+			}
+			std::cout << std::flush;
+			_exit(0);	//no destructors: the output file belongs to the parent
+		}
+		if(pid < 0){
+			G4Exception("RunList::runWorkerPool","forkFailed",JustWarning,"fork failed; continuing w/ less workers");
+			break;
+		}
+		pids.push_back(pid);
+	}
+	for(size_t w = 0; w < pids.size(); w++) waitpid(pids[w], NULL, 0);
 
+	for(size_t j = 0; j < voxels.size(); j++){
+		if(!results[j].done){	//worker died (or was never forked): redo here
+			generator->setCurrentVoxel(voxels[j]);
+			results[j].result = simulateVoxel(rm, generator->getCurrentPhotonsPerVoxel());
+		}
+		writeVoxel(voxels[j], results[j].result);
+	}
+	munmap(shared, bytes);
+}
 
+void RunList::writeVoxel(const L200ParticleGenerator::Voxel& voxel, const VoxelResult& result){
+	G4ThreeVector middle = voxel.pointAt(0.5, 0.5, 0.5);	//cartesian also for the polar grid
+	voxelX = middle.x();
+	voxelY = middle.y();
+	voxelZ = middle.z();
+	count = result.aborted ? 0 : result.counts;
+	initialNr = result.photons;
+	voxelIndex = voxel.index;
+	voxelXWid = voxel.xWid;
+	voxelYWid = voxel.yWid;
+	voxelZWid = voxel.zWid;
+	larFraction = generator->getLArFraction(voxel);
+	qmcError = result.qmcError;
+	sumW = result.aborted ? 0 : result.sumW;
+	sumW2 = result.aborted ? 0 : result.sumW2;
+	nee = result.aborted ? 0 : result.nee;
+
+	fillRow();
+	if(checkpointRows.is_open()) dumpRow(checkpointRows);
+	rowsWritten++;
+}
 
+void RunList::fillRow(){
+	analysis->FillNtupleDColumn(0, voxelX);		//dont mess up ordering!
+	analysis->FillNtupleDColumn(1, voxelY);
+	analysis->FillNtupleDColumn(2, voxelZ);
+	analysis->FillNtupleIColumn(3, count);
+	analysis->FillNtupleIColumn(4, initialNr);
+	analysis->FillNtupleIColumn(5, voxelIndex);
+	analysis->FillNtupleIColumn(6, sweepIndex);
+	analysis->FillNtupleDColumn(7, voxelXWid);
+	analysis->FillNtupleDColumn(8, voxelYWid);
+	analysis->FillNtupleDColumn(9, voxelZWid);
+	analysis->FillNtupleDColumn(10, larFraction);
+	analysis->FillNtupleDColumn(11, qmcError);
+	analysis->FillNtupleDColumn(12, sumW);
+	analysis->FillNtupleDColumn(13, sumW2);
+	analysis->FillNtupleDColumn(14, nee);
 
+	analysis->AddNtupleRow();
 
+	clearVars();
+}
 
 
+void RunList::dumpRow(std::ostream& os){
+	os << std::setprecision(17) << voxelX <<" "<< voxelY <<" "<< voxelZ <<" "<< count <<" "<< initialNr <<" "<< voxelIndex <<" "<< sweepIndex
+		<<" "<< voxelXWid <<" "<< voxelYWid <<" "<< voxelZWid <<" "<< larFraction <<" "<< qmcError <<" "<< sumW <<" "<< sumW2 <<" "<< nee << "\n";
+}
 
+G4bool RunList::readRow(std::istream& is){
+	return (G4bool)(is >> voxelX >> voxelY >> voxelZ >> count >> initialNr >> voxelIndex >> sweepIndex
+		>> voxelXWid >> voxelYWid >> voxelZWid >> larFraction >> qmcError >> sumW >> sumW2 >> nee);
+}
 
+//ofstream has no fsync: sync the file through a descriptor of its own (any descriptor of the file will do)
+static G4bool syncFile(const G4String& name){
+	int fd = ::open(name.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	G4bool synced = (::fsync(fd) == 0);
+	::close(fd);
+	return synced;
+}
 
+//directory entry of a rename
+static G4bool syncDirectoryOf(const G4String& name){
+	size_t slash = name.rfind('/');
+	G4String dir = (slash == std::string::npos) ? G4String(".") : ((slash == 0) ? G4String("/") : G4String(name.substr(0, slash)));
+	return syncFile(dir);
+}
 
+void RunList::openCheckpoint(const std::vector<std::string>& keptRows){
+	//kept rows via tmp & rename: a crash never leaves fewer rows than the last state file counts
+	G4String rowsName = checkpointName+".rows";
+	G4String tmpName = rowsName+".tmp";
+	std::ofstream rows(tmpName.c_str(), std::ios::out | std::ios::trunc);
+	for(size_t i = 0; i < keptRows.size(); i++) rows << keptRows[i] << "\n";
+	rows.close();
+	if(!rows || !syncFile(tmpName) || std::rename(tmpName.c_str(), rowsName.c_str()) != 0 || !syncDirectoryOf(rowsName)){
+		G4Exception("RunList::openCheckpoint","checkpointNotWritable",FatalException,("cannot write "+rowsName).c_str());
+	}
+	checkpointRows.open(rowsName.c_str(), std::ios::out | std::ios::app);
+	if(!checkpointRows){
+		G4Exception("RunList::openCheckpoint","checkpointNotWritable",FatalException,("cannot write "+rowsName).c_str());
+	}
+}
 
+void RunList::writeCheckpoint(){
+	checkpointRows.flush();		//rows 1st: state must never count rows that are not on disk
+	G4bool rowsSynced = syncFile(checkpointName+".rows");
+	voxelsSinceCheckpoint = 0;
+
+	G4String tmpName = checkpointName+".tmp";
+	std::ofstream state(tmpName.c_str(), std::ios::out | std::ios::trunc);
+	state << "g4simple-checkpoint 1\n";
+	state << "flatVoxelIndex " << generator->getFlatVoxelIndex() << "\n";
+	state << "validVoxelCount " << generator->getValidVoxelCount() << "\n";
+	state << "seedBase " << generator->getSeedBase() << "\n";
+	state << "rows " << rowsWritten << "\n";
+	state << "sweepIndex " << sweepIndex << "\n";
+	G4Random::getTheEngine()->put(state);
+	state.close();
+
+	if(!checkpointRows || !rowsSynced || !state || !syncFile(tmpName)
+	   || std::rename(tmpName.c_str(), checkpointName.c_str()) != 0 || !syncDirectoryOf(checkpointName)){
+		G4Exception("RunList::writeCheckpoint","checkpointNotWritten",JustWarning,
+			("could not write checkpoint "+checkpointName+"; previous one kept").c_str());
+	}
+}
 
+std::vector<std::string> RunList::resume(){
+	std::ifstream state(resumeName.c_str());
+	std::string magic, key;
+	G4int version = 0, nRows = 0, stateSweepIndex = 0;
+	uint32_t flatIndex = 0, validCount = 0;
+	long seed = 0;
+	state >> magic >> version;
+	state >> key >> flatIndex >> key >> validCount >> key >> seed >> key >> nRows >> key >> stateSweepIndex;
+	if(!state || magic != "g4simple-checkpoint" || version != 1){
+		G4Exception("RunList::resume","badCheckpoint",FatalException,("cannot read checkpoint "+resumeName).c_str());
+	}
+	G4Random::getTheEngine()->get(state);
+
+	//rows of the interrupted job; anything beyond nRows was written after the last checkpoint and is redone
+	std::ifstream rows((resumeName+".rows").c_str());
+	std::vector<std::string> lines;
+	std::string line;
+	while((G4int)lines.size() < nRows && std::getline(rows, line)) lines.push_back(line);
+	if((G4int)lines.size() < nRows){
+		G4Exception("RunList::resume","badCheckpointRows",FatalException,("missing rows in "+resumeName+".rows").c_str());
+	}
+	for(size_t i = 0; i < lines.size(); i++){
+		std::istringstream is(lines[i]);
+		if(!readRow(is)){
+			G4Exception("RunList::resume","badCheckpointRows",FatalException,("unreadable row in "+resumeName+".rows").c_str());
+		}
+		fillRow();
+	}
+	rowsWritten = nRows;
+	sweepIndex = stateSweepIndex;	//after readRow (rows carry their own sweepIndex)
 
+	generator->setCursor(flatIndex, validCount, seed);
+	std::cout << "Resuming from "<<resumeName<<": "<<nRows<<" voxels done, continuing after flat index "<<flatIndex<<" of sweep point "<<sweepIndex<<std::endl;
+	return lines;
+}
@@ -0,0 +1,82 @@
+#include "WlsrResponseTable.hh"
+#include "G4Exception.hh"
+
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+WlsrResponseTable::WlsrResponseTable()
+	: nZ(0), nPhi(0), zMin(0), zMax(0), wedge(2*M_PI)
+{
+}
+
+
+void WlsrResponseTable::setLayout(G4int nZ, G4int nPhi, G4double zMin, G4double zMax, G4double wedge){
+	this->nZ = (nZ > 0) ? nZ : 1;
+	this->nPhi = (nPhi > 0) ? nPhi : 1;
+	this->zMin = zMin;
+	this->zMax = zMax;
+	this->wedge = wedge;
+	values.assign(size(), 0);
+}
+
+
+void WlsrResponseTable::getPatch(G4int index, G4double& zLow, G4double& zHigh, G4double& phiLow, G4double& phiHigh) const{
+	G4int iZ = index/nPhi;
+	G4int iPhi = index - iZ*nPhi;
+	G4double zWid = (zMax - zMin)/nZ;
+	zLow = zMin + iZ*zWid;
+	zHigh = zLow + zWid;
+	phiLow = iPhi*wedge/nPhi;
+	phiHigh = phiLow + wedge/nPhi;
+}
+
+
+G4double WlsrResponseTable::lookup(const G4ThreeVector& p) const{
+	if(values.empty() || p.z() < zMin || p.z() >= zMax) return 0;
+	//wedges alternate mirrored around the circle (same folding as L200ParticleGenerator::gridIndexAt)
+	G4double phi = std::atan2(p.y(), p.x());
+	if(phi < 0) phi += 2*M_PI;
+	if(wedge < 2*M_PI - 1e-9){
+		phi = std::fmod(phi, 2*wedge);
+		if(phi > wedge) phi = 2*wedge - phi;
+	}
+	G4int iZ = std::min(nZ-1, (G4int)((p.z() - zMin)/(zMax - zMin)*nZ));
+	G4int iPhi = std::min(nPhi-1, (G4int)(phi/wedge*nPhi));
+	return values[iZ*nPhi + iPhi];
+}
+
+
+G4bool WlsrResponseTable::read(const G4String& file, const std::string& key){
+	std::ifstream in(file.c_str());
+	std::string magic, fileKey;
+	G4int version = 0;
+	while(in >> magic >> version >> fileKey){
+		G4int fileNZ = 0, fileNPhi = 0;
+		G4double fileZMin = 0, fileZMax = 0, fileWedge = 0;
+		if(magic != "g4simple-wlsr" || version != 1 || !(in >> fileNZ >> fileNPhi >> fileZMin >> fileZMax >> fileWedge)) return false;
+		std::vector<G4double> fileValues(fileNZ*fileNPhi);
+		for(size_t i = 0; i < fileValues.size(); i++){
+			if(!(in >> fileValues[i])) return false;
+		}
+		if(fileKey != key) continue;	//table of other parameters
+		setLayout(fileNZ, fileNPhi, fileZMin, fileZMax, fileWedge);
+		values.swap(fileValues);
+		return true;
+	}
+	return false;
+}
+
+
+void WlsrResponseTable::write(const G4String& file, const std::string& key) const{
+	std::ofstream out(file.c_str(), std::ios::out | std::ios::app);
+	out << std::setprecision(17) << "g4simple-wlsr 1 " << key << "\n"
+		<< nZ <<" "<< nPhi <<" "<< zMin <<" "<< zMax <<" "<< wedge << "\n";
+	for(size_t i = 0; i < values.size(); i++) out << values[i] << "\n";
+	out.close();
+	if(!out){
+		G4Exception("WlsrResponseTable::write","cacheWriteFailed",JustWarning,
+			("could not write WLSR table cache "+file).c_str());
+	}
+}